@@ -0,0 +1,287 @@
+/**
+ * Microbenchmarks for FixedThreadPool and TimeWheel
+ *
+ * Every case is run a few times after a warm-up run and the median is reported, results are printed to stdout as one
+ * JSON document together with the machine and build it ran on, so runs of two builds can be diffed or fed to a
+ * dashboard. Progress goes to stderr.
+ *
+ * Build and run:
+ *      g++ -std=c++20 -O2 -DNDEBUG -pthread bench/main.cpp -o bench/exec
+ *      ./bench/exec [--quick] [--threads N] [--reps R] [--max-timers N] > results.json
+ *
+ * Cases:
+ *      submit: Post throughput of 1..N producers into a pool of N workers, empty tasks, both modes
+ *      latency: submission to start of a task in ns, p50 / p99 / p999, with the workers parked between tasks (idle)
+ *          and with a steady paced stream of one task every 5 us (loaded)
+ *      fanout: one producer forks K tasks with ParallelFor and joins them, round trips per second
+ *      timer_insert: Appoint rate into a TimeWheel for 1k .. max-timers timers
+ *      timer_expire: timers firing per second once they fall due, all due within a short window
+ */
+
+
+#include "../concurrent/threadpool.hpp"
+#include "../dispatch/timewheel.hpp"
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace bench
+{
+
+    using clock = std::chrono::steady_clock;
+
+    struct Options {
+        size_t threads{std::max(1u, std::thread::hardware_concurrency())};
+        size_t reps{5};
+        size_t tasks{1000000}; // per submit case
+        size_t samples{100000}; // per latency case
+        size_t maxTimers{1000000};
+    };
+
+    double seconds(clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    double median(std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    }
+
+    /**
+     * Run fn once to warm up, then reps times, and return the median of what it returns
+     */
+    double measure(const Options& opt, const std::function<double()>& fn) {
+        fn();
+        std::vector<double> runs;
+        for (size_t i = 0; i < opt.reps; ++i) runs.push_back(fn());
+        return median(runs);
+    }
+
+    const char* name(threadpool::Mode mode) {
+        return mode == threadpool::Mode::Stealing ? "stealing" : "shared";
+    }
+
+    /**
+     * Results collected as JSON objects, printed as one array at the end
+     */
+    struct Report {
+
+        std::vector<std::string> results;
+
+        void add(const std::string& bench, const std::string& params, const std::string& metrics) {
+            results.push_back(
+                "{\"bench\": \"" + bench + "\", \"params\": {" + params + "}, \"metrics\": {" + metrics + "}}");
+            std::cerr << results.back() << std::endl;
+        }
+
+        void print(const Options& opt) const {
+            std::cout << "{\n  \"machine\": {\"hardware_concurrency\": " << std::thread::hardware_concurrency()
+                << ", \"compiler\": \"" << __VERSION__ << "\", \"ndebug\": "
+#if defined(NDEBUG)
+                << "true"
+#else
+                << "false"
+#endif
+                << ", \"threads\": " << opt.threads << ", \"reps\": " << opt.reps << "},\n  \"results\": [\n";
+            for (size_t i = 0; i < results.size(); ++i) {
+                std::cout << "    " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+            }
+            std::cout << "  ]\n}" << std::endl;
+        }
+    };
+
+    template<typename T>
+    std::string kv(const std::string& key, T value) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1) << std::boolalpha << "\"" << key << "\": " << value;
+        return ss.str();
+    }
+
+    std::string kv(const std::string& key, const char* value) {
+        return "\"" + key + "\": \"" + value + "\"";
+    }
+
+    void submit(const Options& opt, Report& report) {
+        for (threadpool::Mode mode : {threadpool::Mode::Shared, threadpool::Mode::Stealing}) {
+            for (size_t producers = 1; producers <= opt.threads; producers *= 2) {
+                double rate = measure(opt, [&] () -> double {
+                    FixedThreadPool pool(opt.threads, mode);
+                    std::atomic<size_t> done{0};
+                    size_t each = opt.tasks / producers;
+                    clock::time_point start = clock::now();
+                    std::vector<std::thread> threads;
+                    for (size_t p = 0; p < producers; ++p) {
+                        threads.emplace_back([&] () -> void {
+                            for (size_t i = 0; i < each; ++i) {
+                                pool.Post(threadpool::Runnable([&done] () -> void {
+                                    done.fetch_add(1, std::memory_order_relaxed);
+                                }));
+                            }
+                        });
+                    }
+                    for (auto& t : threads) t.join();
+                    while (done.load() < each * producers) std::this_thread::yield();
+                    return static_cast<double>(each * producers) / seconds(clock::now() - start);
+                });
+                report.add("submit", kv("mode", name(mode)) + ", " + kv("workers", opt.threads) + ", " +
+                    kv("producers", producers), kv("tasks_per_sec", rate));
+            }
+        }
+    }
+
+    void latency(const Options& opt, Report& report) {
+        for (threadpool::Mode mode : {threadpool::Mode::Shared, threadpool::Mode::Stealing}) {
+            for (bool loaded : {false, true}) {
+                std::vector<double> p50, p99, p999;
+                for (size_t r = 0; r < opt.reps; ++r) {
+                    FixedThreadPool pool(opt.threads, mode);
+                    size_t n = loaded ? opt.samples : opt.samples / 10;
+                    std::vector<uint64_t> ns(n);
+                    std::atomic<size_t> done{0};
+                    clock::time_point start = clock::now();
+                    for (size_t i = 0; i < n; ++i) {
+                        if (loaded) {
+                            // open loop: the next task is due at a fixed rate however long the previous ones take
+                            clock::time_point slot = start + std::chrono::microseconds(5) * i;
+                            while (clock::now() < slot) std::this_thread::yield();
+                        }
+                        clock::time_point submitted = clock::now();
+                        pool.Post(threadpool::Runnable([&ns, &done, i, submitted] () -> void {
+                            ns[i] = static_cast<uint64_t>(
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - submitted).count());
+                            done.fetch_add(1, std::memory_order_release);
+                        }));
+                        if (!loaded) {
+                            // let the worker finish and park again before the next task
+                            while (done.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+                            std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        }
+                    }
+                    while (done.load(std::memory_order_acquire) < n) std::this_thread::yield();
+                    std::sort(ns.begin(), ns.end());
+                    p50.push_back(static_cast<double>(ns[n / 2]));
+                    p99.push_back(static_cast<double>(ns[n * 99 / 100]));
+                    p999.push_back(static_cast<double>(ns[n * 999 / 1000]));
+                }
+                report.add("latency", kv("mode", name(mode)) + ", " + kv("workers", opt.threads) + ", " +
+                    kv("load", loaded ? "loaded" : "idle"),
+                    kv("p50_ns", median(p50)) + ", " + kv("p99_ns", median(p99)) + ", " + kv("p999_ns", median(p999)));
+            }
+        }
+    }
+
+    void fanout(const Options& opt, Report& report) {
+        for (threadpool::Mode mode : {threadpool::Mode::Shared, threadpool::Mode::Stealing}) {
+            FixedThreadPool pool(opt.threads, mode);
+            for (size_t width : {size_t(4), size_t(64), size_t(1024)}) {
+                size_t rounds = 100000 / width + 10;
+                double rate = measure(opt, [&] () -> double {
+                    std::atomic<size_t> sink{0};
+                    clock::time_point start = clock::now();
+                    for (size_t r = 0; r < rounds; ++r) {
+                        pool.ParallelFor(size_t(0), width, 1, [&sink] (size_t i) -> void {
+                            sink.fetch_add(i, std::memory_order_relaxed);
+                        }).Wait();
+                    }
+                    return static_cast<double>(rounds) / seconds(clock::now() - start);
+                });
+                report.add("fanout", kv("mode", name(mode)) + ", " + kv("workers", opt.threads) + ", " +
+                    kv("width", width), kv("rounds_per_sec", rate));
+            }
+        }
+    }
+
+    void timers(const Options& opt, Report& report) {
+        auto pool = std::make_shared<FixedThreadPool>(opt.threads);
+        std::mt19937 rng(42); // fixed seed, every build sees the same delays
+        for (size_t n = 1000; n <= opt.maxTimers; n *= 10) {
+            // 1 ms ticks, everything falls due within 64 ticks starting 200 ms out
+            std::vector<int> delays(n);
+            std::uniform_int_distribution<int> spread(200, 263);
+            for (auto& d : delays) d = spread(rng);
+            std::vector<double> inserts, expires;
+            bool complete = true;
+            size_t reps = n >= 1000000 ? 1 : opt.reps;
+            for (size_t r = 0; r < reps; ++r) {
+                TimeWheel<int, std::milli> wheel(4096, 1, pool);
+                std::atomic<size_t> fired{0};
+                auto fn = std::make_shared<std::function<void()>>([&fired] () -> void {
+                    fired.fetch_add(1, std::memory_order_relaxed);
+                });
+                clock::time_point start = clock::now();
+                for (size_t i = 0; i < n; ++i) wheel.Appoint(delays[i], fn);
+                clock::time_point inserted = clock::now();
+                inserts.push_back(static_cast<double>(n) / seconds(inserted - start));
+                // measure from when the first timer falls due
+                clock::time_point due = start + std::chrono::milliseconds(200);
+                clock::time_point limit = inserted + std::chrono::seconds(60);
+                while (fired.load() < n && clock::now() < limit) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                if (fired.load() < n) complete = false;
+                clock::time_point end = clock::now();
+                expires.push_back(static_cast<double>(fired.load()) / seconds(end - std::max(due, inserted)));
+            }
+            report.add("timer_insert", kv("timers", n), kv("inserts_per_sec", median(inserts)));
+            report.add("timer_expire", kv("timers", n) + ", " + kv("window_ms", 64),
+                kv("expiries_per_sec", median(expires)) + ", " + kv("complete", complete));
+        }
+    }
+
+} // namespace bench
+
+
+int main(int argc, char** argv) {
+    bench::Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&] () -> size_t {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        };
+        if (arg == "--quick") {
+            opt.reps = 1;
+            opt.tasks = 100000;
+            opt.samples = 10000;
+            opt.maxTimers = 100000;
+        } else if (arg == "--threads") {
+            opt.threads = std::max<size_t>(1, next());
+        } else if (arg == "--reps") {
+            opt.reps = std::max<size_t>(1, next());
+        } else if (arg == "--max-timers") {
+            opt.maxTimers = next();
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--threads N] [--reps R] [--max-timers N]" << std::endl;
+            return 2;
+        }
+    }
+
+    bench::Report report;
+    bench::submit(opt, report);
+    bench::latency(opt, report);
+    bench::fanout(opt, report);
+    bench::timers(opt, report);
+    report.print(opt);
+
+    return 0;
+}
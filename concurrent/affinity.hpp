@@ -0,0 +1,228 @@
+/**
+ * CPU and NUMA node placement for pool workers
+ *
+ * The topology is read from /sys/devices/system/node on Linux, restricted to the cpus the process may run on
+ * (sched_getaffinity, which reflects taskset and cgroup / container cpusets), and workers are pinned with
+ * pthread_setaffinity_np. Elsewhere (macOS has no hard affinity) the topology is a single node with every cpu and
+ * pinning is a no-op, so a placement policy degrades to the unpinned behaviour instead of failing.
+ *
+ * Memory placement relies on the kernel's first-touch policy: a pinned worker allocates and initializes its own
+ * state, so the pages end up on the worker's node without linking libnuma.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace affinity
+{
+
+    /**
+     * Where the workers of a pool run
+     *
+     * None: leave scheduling to the kernel
+     * Compact: fill the cpus of node 0 first, then node 1, ... so workers share caches
+     * Scatter: deal workers round-robin across nodes to spread memory bandwidth
+     * CpuSet: worker i is pinned to cpus[i % cpus.size()]
+     * Node: every worker is confined to the cpus of one node (by kernel node id), build one pool per node with this
+     */
+    enum class Placement {
+        None,
+        Compact,
+        Scatter,
+        CpuSet,
+        Node
+    };
+
+    struct Policy {
+        Placement placement{Placement::None};
+        std::vector<int> cpus; // CpuSet only
+        int node{0}; // Node only, a kernel node id, ids without allowed cpus map to node % Nodes() instead
+    };
+
+    /**
+     * The allowed cpus of every NUMA node that has any, in node id order
+     */
+    struct Topology {
+
+        std::vector<std::vector<int>> nodes;
+        std::vector<int> ids; // kernel node id of every entry in nodes, ids may have gaps
+
+        /**
+         * Index into nodes of the given kernel node id, -1 if it has no allowed cpus
+         */
+        int IndexOf(int id) const {
+            for (size_t n = 0; n < ids.size(); ++n) {
+                if (ids[n] == id) return static_cast<int>(n);
+            }
+            return -1;
+        }
+
+        /**
+         * Index into nodes of the node of the given cpu, 0 if unknown
+         */
+        int NodeOf(int cpu) const {
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                for (int c : nodes[n]) {
+                    if (c == cpu) return static_cast<int>(n);
+                }
+            }
+            return 0;
+        }
+    };
+
+    /**
+     * Parse a kernel cpu list such as "0-3,8,10-11"
+     */
+    inline std::vector<int> ParseList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            if (range.empty() || range == "\n") continue;
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int c = first; c <= last; ++c) cpus.push_back(c);
+        }
+        return cpus;
+    }
+
+    /**
+     * The cpus the calling process may run on, empty if unknown
+     */
+    inline std::vector<int> Allowed() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+            }
+        }
+#endif
+        return cpus;
+    }
+
+    /**
+     * Discover the machine topology once, cpus outside the process affinity mask are left out and nodes without
+     * allowed cpus (memory-only nodes, nodes fenced off by a cpuset) are skipped
+     */
+    inline const Topology& Discover() {
+        static const Topology topology = [] () -> Topology {
+            Topology t;
+            std::vector<int> allowed = Allowed();
+            auto permitted = [&allowed] (int c) -> bool {
+                return allowed.empty() || std::find(allowed.begin(), allowed.end(), c) != allowed.end();
+            };
+#if defined(__linux__)
+            // node ids need not be contiguous, the online list names the ones that exist
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string ids;
+            if (online) std::getline(online, ids);
+            for (int n : ParseList(ids)) {
+                std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+                if (!in) continue;
+                std::string list;
+                std::getline(in, list);
+                std::vector<int> cpus;
+                for (int c : ParseList(list)) {
+                    if (permitted(c)) cpus.push_back(c);
+                }
+                if (cpus.empty()) continue;
+                t.nodes.push_back(std::move(cpus));
+                t.ids.push_back(n);
+            }
+#endif
+            if (t.nodes.empty()) {
+                t.nodes.push_back(allowed);
+                t.ids.push_back(0);
+                if (allowed.empty()) {
+                    unsigned n = std::thread::hardware_concurrency();
+                    for (unsigned c = 0; c < (n == 0 ? 1 : n); ++c) t.nodes.back().push_back(static_cast<int>(c));
+                }
+            }
+            return t;
+        }();
+        return topology;
+    }
+
+    /**
+     * Number of NUMA nodes that have cpus
+     */
+    inline size_t Nodes() {
+        return Discover().nodes.size();
+    }
+
+    /**
+     * The cpus worker i of a pool with the given policy may run on, empty for no pinning
+     */
+    inline std::vector<int> CpusFor(const Policy& policy, size_t i) {
+        const Topology& t = Discover();
+        switch (policy.placement) {
+            case Placement::Compact: {
+                std::vector<int> all;
+                for (const auto& node : t.nodes) all.insert(all.end(), node.begin(), node.end());
+                return {all[i % all.size()]};
+            }
+            case Placement::Scatter: {
+                const auto& node = t.nodes[i % t.nodes.size()];
+                return {node[(i / t.nodes.size()) % node.size()]};
+            }
+            case Placement::CpuSet:
+                if (policy.cpus.empty()) return {};
+                return {policy.cpus[i % policy.cpus.size()]};
+            case Placement::Node: {
+                int n = t.IndexOf(policy.node);
+                return t.nodes[n < 0 ? static_cast<size_t>(policy.node) % t.nodes.size() : static_cast<size_t>(n)];
+            }
+            default:
+                return {};
+        }
+    }
+
+    /**
+     * Pin the calling thread to the given cpus
+     *
+     * @return false if pinning is unsupported or was refused, the thread then keeps running unpinned
+     */
+    inline bool Pin(const std::vector<int>& cpus) {
+        if (cpus.empty()) return false;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : cpus) CPU_SET(c, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Node of the cpu the calling thread is currently running on
+     */
+    inline int CurrentNode() {
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0) return Discover().NodeOf(cpu);
+#endif
+        return 0;
+    }
+
+} // namespace affinity
@@ -0,0 +1,200 @@
+/**
+ * Parallel algorithms on FixedThreadPool
+ *
+ * Every algorithm splits its range in halves, hands one half to the pool as a TaskGroup child and keeps working on
+ * the other, until a piece is no larger than the grain. The calling thread takes part and helps run queued pieces
+ * while it waits, so the algorithms can be nested and called from inside pool tasks. In stealing mode the pieces a
+ * worker spawns stay on its own deque and idle workers steal the largest (oldest) ones, which balances uneven work.
+ *
+ * Without an explicit grain the range is cut into about eight pieces per worker, enough slack for stealing to even
+ * out imbalance while keeping the per-piece overhead small.
+ *
+ * Usage example:
+ *      long sum = threadpool::ParallelReduce(pool, v.begin(), v.end(), 0L, std::plus<>());
+ *      threadpool::ParallelSort(pool, v.begin(), v.end());
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "threadpool.hpp"
+#include "taskgroup.hpp"
+
+
+namespace threadpool
+{
+
+    namespace detail
+    {
+
+        // pieces per worker when the grain is chosen automatically
+        inline constexpr size_t slack = 8;
+
+        inline size_t grain(const FixedThreadPool& pool, size_t n, size_t given, size_t least = 1) {
+            if (given != 0) return given;
+            size_t g = n / (pool.Size() * slack + 1);
+            return g < least ? least : g;
+        }
+
+        /**
+         * Call body(first, last) on pieces of at most grain elements covering [first, last)
+         */
+        template<typename It, typename Body>
+        void divide(FixedThreadPool& pool, It first, It last, size_t grain, Body& body) {
+            size_t n = static_cast<size_t>(last - first);
+            if (n <= grain) {
+                if (n > 0) body(first, last);
+                return;
+            }
+            It mid = first + static_cast<std::ptrdiff_t>(n / 2);
+            TaskGroup group(pool);
+            group.Spawn([&pool, mid, last, grain, &body] () -> void { divide(pool, mid, last, grain, body); });
+            divide(pool, first, mid, grain, body);
+            group.Wait();
+        }
+
+        template<typename T, typename It, typename Op>
+        T fold(FixedThreadPool& pool, It first, It last, size_t grain, Op& op) {
+            size_t n = static_cast<size_t>(last - first);
+            if (n <= grain) {
+                T acc = *first;
+                for (++first; first != last; ++first) acc = op(std::move(acc), *first);
+                return acc;
+            }
+            It mid = first + static_cast<std::ptrdiff_t>(n / 2);
+            std::optional<T> right;
+            TaskGroup group(pool);
+            group.Spawn([&pool, mid, last, grain, &op, &right] () -> void {
+                right.emplace(fold<T>(pool, mid, last, grain, op));
+            });
+            T left = fold<T>(pool, first, mid, grain, op);
+            group.Wait();
+            return op(std::move(left), std::move(*right));
+        }
+
+        template<typename It, typename Compare>
+        void sort(FixedThreadPool& pool, It first, It last, size_t grain, Compare& comp) {
+            size_t n = static_cast<size_t>(last - first);
+            if (n <= grain) {
+                std::sort(first, last, comp);
+                return;
+            }
+            // split at the median so both halves are always the same size, no bad pivots
+            It mid = first + static_cast<std::ptrdiff_t>(n / 2);
+            std::nth_element(first, mid, last, comp);
+            TaskGroup group(pool);
+            group.Spawn([&pool, mid, last, grain, &comp] () -> void { sort(pool, mid + 1, last, grain, comp); });
+            sort(pool, first, mid, grain, comp);
+            group.Wait();
+        }
+
+    } // namespace detail
+
+    /**
+     * Invoke fn on every element of [first, last)
+     *
+     * @param grain the largest piece run as one task, 0 to choose it from the pool size
+     */
+    template<typename It, typename Func>
+    void ParallelForEach(FixedThreadPool& pool, It first, It last, Func fn, size_t grain = 0) {
+        size_t n = static_cast<size_t>(last - first);
+        auto body = [&fn] (It b, It e) -> void {
+            for (; b != e; ++b) fn(*b);
+        };
+        detail::divide(pool, first, last, detail::grain(pool, n, grain), body);
+    }
+
+    /**
+     * Write fn(x) for every x of [first, last) to the range starting at out, which may be first itself
+     *
+     * @return the end of the output range
+     */
+    template<typename It, typename Out, typename Func>
+    Out ParallelTransform(FixedThreadPool& pool, It first, It last, Out out, Func fn, size_t grain = 0) {
+        size_t n = static_cast<size_t>(last - first);
+        auto body = [first, out, &fn] (It b, It e) -> void {
+            Out o = out + (b - first);
+            for (; b != e; ++b, ++o) *o = fn(*b);
+        };
+        detail::divide(pool, first, last, detail::grain(pool, n, grain), body);
+        return out + static_cast<std::ptrdiff_t>(n);
+    }
+
+    /**
+     * Combine init and every element of [first, last) with op, which must be associative; pieces are combined in 
+     * order, so op need not be commutative
+     */
+    template<typename It, typename T, typename Op>
+    T ParallelReduce(FixedThreadPool& pool, It first, It last, T init, Op op, size_t grain = 0) {
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return init;
+        return op(std::move(init), detail::fold<T>(pool, first, last, detail::grain(pool, n, grain), op));
+    }
+
+    /**
+     * Inclusive scan: out[i] = init op x[0] op ... op x[i], op must be associative, out may be first itself
+     *
+     * Runs in two parallel passes over fixed pieces: the first computes every piece's total, a short sequential 
+     * scan turns those into offsets, and the second scans every piece from its offset.
+     *
+     * @return the end of the output range
+     */
+    template<typename It, typename Out, typename T, typename Op>
+    Out ParallelScan(FixedThreadPool& pool, It first, It last, Out out, T init, Op op, size_t grain = 0) {
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return out;
+        size_t g = detail::grain(pool, n, grain);
+        size_t pieces = (n + g - 1) / g;
+        std::vector<std::optional<T>> totals(pieces);
+        auto piece = [first, last, g] (size_t i) -> std::pair<It, It> {
+            It b = first + static_cast<std::ptrdiff_t>(i * g);
+            return {b, static_cast<size_t>(last - b) <= g ? last : b + static_cast<std::ptrdiff_t>(g)};
+        };
+        std::vector<size_t> ids(pieces);
+        std::iota(ids.begin(), ids.end(), size_t(0));
+        ParallelForEach(pool, ids.begin(), ids.end(), [&] (size_t i) -> void {
+            auto [b, e] = piece(i);
+            T acc = *b;
+            for (++b; b != e; ++b) acc = op(std::move(acc), *b);
+            totals[i].emplace(std::move(acc));
+        }, 1);
+        std::vector<T> offsets;
+        offsets.reserve(pieces);
+        offsets.push_back(std::move(init));
+        for (size_t i = 0; i + 1 < pieces; ++i) offsets.push_back(op(offsets.back(), std::move(*totals[i])));
+        ParallelForEach(pool, ids.begin(), ids.end(), [&] (size_t i) -> void {
+            auto [b, e] = piece(i);
+            Out o = out + (b - first);
+            T acc = offsets[i];
+            for (; b != e; ++b, ++o) {
+                acc = op(std::move(acc), *b);
+                *o = acc;
+            }
+        }, 1);
+        return out + static_cast<std::ptrdiff_t>(n);
+    }
+
+    /**
+     * Sort [first, last) with comp, not stable
+     *
+     * Ranges are split at their median (std::nth_element) and the halves sorted in parallel, pieces below the grain 
+     * are left to std::sort.
+     */
+    template<typename It, typename Compare = std::less<>>
+    void ParallelSort(FixedThreadPool& pool, It first, It last, Compare comp = Compare(), size_t grain = 0) {
+        size_t n = static_cast<size_t>(last - first);
+        detail::sort(pool, first, last, detail::grain(pool, n, grain, 2048), comp);
+    }
+
+} // namespace threadpool
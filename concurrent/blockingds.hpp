@@ -1,12 +1,458 @@
+/**
+ * Blocking data structures shared between producer and consumer threads
+ */
+
+
 #pragma once
 
 
+#include <cstddef>
+
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+#include <vector>
+#include <functional>
+
+#include <atomic>
+#include <thread>
+
+#include <mutex>
+#include <condition_variable>
+
+#include <chrono>
+
+
+namespace blockingds
+{
+
+    /**
+     * hardware_destructive_interference_size is missing from some standard libraries, 64 bytes is the line size
+     * of every x86 and most arm cores
+     */
+    inline constexpr size_t cacheline = 64;
+
+    // spin this many times on a full or empty queue before parking the thread
+    inline constexpr int spins = 128;
+
+    /**
+     * Parking lot for one side (producers or consumers) of a queue, the atomic waiter count lets the other side
+     * skip the mutex and the notify syscall entirely while nobody is parked
+     */
+    struct Parking {
+        std::atomic<size_t> waiters{0};
+        std::mutex mtx;
+        std::condition_variable cond;
+
+        void wake() {
+            // seq_cst pairs with the increment in park, either we see the waiter or it sees the new state
+            if (waiters.load() > 0) {
+                std::unique_lock<std::mutex> lock(mtx);
+                cond.notify_one();
+            }
+        }
+
+        template<typename Pred, typename TimePoint>
+        bool park(Pred ready, const TimePoint& deadline) {
+            std::unique_lock<std::mutex> lock(mtx);
+            waiters.fetch_add(1);
+            bool ok = cond.wait_until(lock, deadline, ready);
+            waiters.fetch_sub(1);
+            return ok;
+        }
+
+        template<typename Pred>
+        void park(Pred ready) {
+            std::unique_lock<std::mutex> lock(mtx);
+            waiters.fetch_add(1);
+            cond.wait(lock, ready);
+            waiters.fetch_sub(1);
+        }
+    };
+
+} // namespace blockingds
+
+
+/**
+ * A bounded multi-producer multi-consumer queue on a ring buffer with per-slot sequence numbers (Vyukov)
+ *
+ * Every slot carries a sequence number: a producer may fill slot i at position pos when seq == pos, a consumer
+ * may drain it when seq == pos + 1, so producers and consumers only contend on the head / tail counters with one
+ * CAS each and never on a lock. Blocking calls spin briefly and then park on a condition variable.
+ *
+ * Usage example:
+ *      BlockingQueue<int> q(1024);
+ *      q.Push(1);
+ *      int v = q.Pop();
+ *
+ * @tparam T the element type, must be default constructible and movable
+ */
+template<typename T>
 class BlockingQueue {
 
+private:
+
+    struct alignas(blockingds::cacheline) Slot {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    // keep the producer and consumer cursors on separate cache lines
+    alignas(blockingds::cacheline) std::atomic<size_t> tail; // next position to push
+    alignas(blockingds::cacheline) std::atomic<size_t> head; // next position to pop
+
+    blockingds::Parking producers;
+    blockingds::Parking consumers;
+
+public:
+
+    /**
+     * @param capacity the maximum number of queued items, rounded up to a power of two
+     */
+    explicit BlockingQueue(size_t capacity) : mask(roundup(capacity) - 1), slots(new Slot[mask + 1]), tail(0), head(0) {
+        for (size_t i = 0; i <= mask; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BlockingQueue(const BlockingQueue&) = delete;
+    BlockingQueue& operator=(const BlockingQueue&) = delete;
+
+    ~BlockingQueue() {
+        T tmp;
+        while (TryPop(tmp)) {}
+    }
+
+    size_t Capacity() const {
+        return mask + 1;
+    }
+
+    /**
+     * Approximate number of queued items, exact only when no other thread is pushing or popping
+     */
+    size_t Size() const {
+        size_t t = tail.load();
+        size_t h = head.load();
+        return t > h ? t - h : 0;
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    /**
+     * Push without blocking, the item is left untouched when the queue is full
+     *
+     * @return false if the queue is full
+     */
+    bool TryPush(const T& item) {
+        return enqueue(item);
+    }
+
+    bool TryPush(T&& item) {
+        return enqueue(std::move(item));
+    }
+
+    /**
+     * Pop without blocking
+     *
+     * @return false if the queue is empty
+     */
+    bool TryPop(T& out) {
+        if (!dequeue(out)) return false;
+        producers.wake();
+        return true;
+    }
+
+    /**
+     * Push, spinning briefly and then parking while the queue is full
+     */
+    void Push(T item) {
+        for (int i = 0; i < blockingds::spins; ++i) {
+            if (enqueue(std::move(item))) return;
+            pause(i);
+        }
+        while (!enqueue(std::move(item))) {
+            producers.park([this] () -> bool { return !full(); });
+        }
+    }
+
+    /**
+     * Pop, spinning briefly and then parking while the queue is empty
+     */
+    T Pop() {
+        T out;
+        for (int i = 0; i < blockingds::spins; ++i) {
+            if (TryPop(out)) return out;
+            pause(i);
+        }
+        while (!TryPop(out)) {
+            consumers.park([this] () -> bool { return !Empty(); });
+        }
+        return out;
+    }
+
+    /**
+     * Push, waiting at most timeout for room in the queue
+     *
+     * @return false if the queue stayed full until the timeout, the item is left untouched
+     */
+    template<typename Rep, typename Period>
+    bool TryPushFor(T& item, std::chrono::duration<Rep, Period> timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (int i = 0; i < blockingds::spins; ++i) {
+            if (enqueue(std::move(item))) return true;
+            pause(i);
+        }
+        while (!enqueue(std::move(item))) {
+            if (!producers.park([this] () -> bool { return !full(); }, deadline)) {
+                return enqueue(std::move(item));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Pop, waiting at most timeout for an item
+     *
+     * @return false if the queue stayed empty until the timeout
+     */
+    template<typename Rep, typename Period>
+    bool TryPopFor(T& out, std::chrono::duration<Rep, Period> timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (int i = 0; i < blockingds::spins; ++i) {
+            if (TryPop(out)) return true;
+            pause(i);
+        }
+        while (!TryPop(out)) {
+            if (!consumers.park([this] () -> bool { return !Empty(); }, deadline)) {
+                return TryPop(out);
+            }
+        }
+        return true;
+    }
+
+private: // helpers
+
+    static size_t roundup(size_t n) {
+        size_t p = 2;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    static void pause(int i) {
+        if (i > blockingds::spins / 2) std::this_thread::yield();
+    }
+
+    bool full() const {
+        return Size() > mask;
+    }
+
+    template<typename U>
+    bool enqueue(U&& item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                // slot is free for this lap, claim it
+                if (tail.compare_exchange_weak(pos, pos + 1)) break;
+            } else if (diff < 0) {
+                return false; // slot still holds last lap's item: full
+            } else {
+                pos = tail.load(std::memory_order_relaxed); // another producer took it
+            }
+        }
+        ::new (slot->storage) T(std::forward<U>(item));
+        slot->seq.store(pos + 1, std::memory_order_release);
+        consumers.wake();
+        return true;
+    }
+
+    bool dequeue(T& out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1)) break;
+            } else if (diff < 0) {
+                return false; // nothing published in this slot yet: empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = slot->item();
+        out = std::move(*item);
+        item->~T();
+        // free the slot for the producer one lap ahead
+        slot->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
 };
 
 
+/**
+ * A thread-safe priority queue on a 4-ary heap in contiguous storage
+ *
+ * A 4-ary heap is half as deep as a binary heap and the four children of a node sit next to each other in memory,
+ * so a sift-down touches fewer cache lines. Like std::priority_queue the top element is the greatest according to
+ * the comparator. Drain pops a batch under a single lock acquisition.
+ *
+ * Usage example:
+ *      BlockingPriorityQueue<Job, ByDeadline> q;
+ *      q.Push(job);
+ *      std::vector<Job> batch;
+ *      q.Drain(32, batch);
+ *
+ * @tparam T the element type
+ * @tparam Compare strict weak ordering, the element that compares greatest is popped first
+ */
+template<typename T, typename Compare = std::less<T>>
 class BlockingPriorityQueue {
 
-};
+private:
+
+    static constexpr size_t arity = 4;
+
+    std::vector<T> heap;
+    Compare cmp;
 
+    mutable std::mutex mtx;
+    std::condition_variable cond;
+
+public:
+
+    explicit BlockingPriorityQueue(Compare c = Compare(), size_t reserve = 0) : cmp(std::move(c)) {
+        heap.reserve(reserve);
+    }
+
+    BlockingPriorityQueue(const BlockingPriorityQueue&) = delete;
+    BlockingPriorityQueue& operator=(const BlockingPriorityQueue&) = delete;
+
+    size_t Size() const {
+        std::unique_lock<std::mutex> lock(mtx);
+        return heap.size();
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    void Push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            heap.push_back(std::move(item));
+            siftup(heap.size() - 1);
+        }
+        cond.notify_one();
+    }
+
+    /**
+     * Pop the top element without blocking
+     *
+     * @return false if the queue is empty
+     */
+    bool TryPop(T& out) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (heap.empty()) return false;
+        out = poptop();
+        return true;
+    }
+
+    /**
+     * Pop the top element, blocking while the queue is empty
+     */
+    T Pop() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [this] () -> bool { return !heap.empty(); });
+        return poptop();
+    }
+
+    /**
+     * Pop the top element, waiting at most timeout for one to arrive
+     *
+     * @return false if the queue stayed empty until the timeout
+     */
+    template<typename Rep, typename Period>
+    bool TryPopFor(T& out, std::chrono::duration<Rep, Period> timeout) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!cond.wait_for(lock, timeout, [this] () -> bool { return !heap.empty(); })) return false;
+        out = poptop();
+        return true;
+    }
+
+    /**
+     * Pop up to n elements in priority order under one lock acquisition, without blocking
+     *
+     * @param n the maximum number of elements to pop
+     * @param out the popped elements are appended here, reuse the vector across calls to avoid reallocation
+     * @return the number of elements popped
+     */
+    size_t Drain(size_t n, std::vector<T>& out) {
+        std::unique_lock<std::mutex> lock(mtx);
+        size_t count = 0;
+        while (count < n && !heap.empty()) {
+            out.push_back(poptop());
+            ++count;
+        }
+        return count;
+    }
+
+private: // helpers, callers hold mtx
+
+    T poptop() {
+        T top = std::move(heap.front());
+        if (heap.size() > 1) {
+            heap.front() = std::move(heap.back());
+            heap.pop_back();
+            siftdown(0);
+        } else {
+            heap.pop_back();
+        }
+        return top;
+    }
+
+    void siftup(size_t i) {
+        T item = std::move(heap[i]);
+        while (i > 0) {
+            size_t parent = (i - 1) / arity;
+            if (!cmp(heap[parent], item)) break;
+            heap[i] = std::move(heap[parent]);
+            i = parent;
+        }
+        heap[i] = std::move(item);
+    }
+
+    void siftdown(size_t i) {
+        const size_t n = heap.size();
+        T item = std::move(heap[i]);
+        while (true) {
+            size_t first = i * arity + 1;
+            if (first >= n) break;
+            // pick the greatest of up to four adjacent children
+            size_t best = first;
+            size_t last = first + arity < n ? first + arity : n;
+            for (size_t c = first + 1; c < last; ++c) {
+                if (cmp(heap[best], heap[c])) best = c;
+            }
+            if (!cmp(item, heap[best])) break;
+            heap[i] = std::move(heap[best]);
+            i = best;
+        }
+        heap[i] = std::move(item);
+    }
+};
@@ -0,0 +1,217 @@
+/**
+ * C++20 coroutine support for the thread pools
+ *
+ * A Task<T> is a lazily started coroutine returning T. Awaiting it from another coroutine starts it and, when it
+ * finishes, transfers control straight back to the awaiting coroutine (symmetric transfer), so long await chains
+ * neither grow the stack nor bounce through the pool. Combined with FixedThreadPool::Schedule and TimeWheel::Sleep,
+ * thousands of in-flight operations cost one coroutine frame each instead of a blocked thread.
+ *
+ * Usage example:
+ *      threadpool::Task<int> work(FixedThreadPool& pool) {
+ *          co_await pool.Schedule();   // now running on a worker
+ *          co_return 42;
+ *      }
+ *      int v = threadpool::SyncWait(work(pool));
+ */
+
+
+#pragma once
+
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <optional>
+#include <type_traits>
+
+#include <mutex>
+#include <condition_variable>
+
+
+namespace threadpool
+{
+
+    template<typename T>
+    class Task;
+
+    namespace detail
+    {
+
+        /**
+         * Promise parts shared by every Task, the continuation is the coroutine awaiting this one
+         */
+        struct PromiseBase {
+
+            std::coroutine_handle<> continuation{std::noop_coroutine()};
+            std::exception_ptr error;
+
+            struct Final {
+                bool await_ready() const noexcept { return false; }
+
+                template<typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    return h.promise().continuation;
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            Final final_suspend() const noexcept { return {}; }
+
+            void unhandled_exception() noexcept {
+                error = std::current_exception();
+            }
+        };
+
+        template<typename T>
+        struct Promise : PromiseBase {
+
+            std::optional<T> value;
+
+            Task<T> get_return_object() noexcept;
+
+            template<typename U>
+            void return_value(U&& v) {
+                value.emplace(std::forward<U>(v));
+            }
+
+            T result() {
+                if (error) std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase {
+
+            Task<void> get_return_object() noexcept;
+
+            void return_void() noexcept {}
+
+            void result() {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+
+    } // namespace detail
+
+    /**
+     * A lazily started coroutine producing T, owns its frame and is awaitable exactly once
+     */
+    template<typename T = void>
+    class Task {
+
+    public:
+
+        using promise_type = detail::Promise<T>;
+
+    private:
+
+        std::coroutine_handle<promise_type> coro;
+
+    public:
+
+        explicit Task(std::coroutine_handle<promise_type> h) noexcept : coro(h) {}
+
+        Task(Task&& other) noexcept : coro(std::exchange(other.coro, {})) {}
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (coro) coro.destroy();
+                coro = std::exchange(other.coro, {});
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() {
+            if (coro) coro.destroy();
+        }
+
+        bool await_ready() const noexcept {
+            return !coro || coro.done();
+        }
+
+        // start the task and resume the awaiter when it finishes, without going through any scheduler
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            coro.promise().continuation = awaiting;
+            return coro;
+        }
+
+        T await_resume() {
+            return coro.promise().result();
+        }
+    };
+
+    namespace detail
+    {
+
+        template<typename T>
+        Task<T> Promise<T>::get_return_object() noexcept {
+            return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Promise<void>::get_return_object() noexcept {
+            return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+
+        /**
+         * Eagerly started, self-destroying coroutine used by SyncWait to drive a Task from a plain thread
+         */
+        struct Driver {
+            struct promise_type {
+                Driver get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        template<typename T>
+        struct Waiter {
+            std::mutex mtx;
+            std::condition_variable cond;
+            bool done{false};
+            std::exception_ptr error;
+            std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+        };
+
+        template<typename T>
+        Driver drive(Task<T>& task, Waiter<T>& w) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await task;
+                    w.value.emplace(true);
+                } else {
+                    w.value.emplace(co_await task);
+                }
+            } catch (...) {
+                w.error = std::current_exception();
+            }
+            std::unique_lock<std::mutex> lock(w.mtx);
+            w.done = true;
+            w.cond.notify_all();
+        }
+
+    } // namespace detail
+
+    /**
+     * Run a task to completion from a thread that is not a coroutine, blocking it until the task finishes
+     *
+     * @return the task's result, its exception is rethrown
+     */
+    template<typename T>
+    T SyncWait(Task<T> task) {
+        detail::Waiter<T> w;
+        detail::drive(task, w);
+        std::unique_lock<std::mutex> lock(w.mtx);
+        w.cond.wait(lock, [&w] () -> bool { return w.done; });
+        if (w.error) std::rethrow_exception(w.error);
+        if constexpr (!std::is_void_v<T>) return std::move(*w.value);
+    }
+
+} // namespace threadpool
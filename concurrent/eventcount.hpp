@@ -0,0 +1,99 @@
+/**
+ * Event count: lets threads sleep until some condition on lock-free state becomes true, without a mutex
+ *
+ * A waiter announces itself, reads the epoch, rechecks its condition and only then sleeps on the epoch word; a
+ * notifier bumps the epoch and issues the wake syscall only when the waiter count says somebody may be asleep. With
+ * every worker busy a notification therefore costs one atomic load. Sleeping uses C++20 atomic wait on a 32-bit
+ * word, which is a plain futex on Linux.
+ *
+ * Usage example:
+ *      // consumer                                  // producer
+ *      while (!queue.TryPop(item)) {                 queue.Push(item);
+ *          auto key = ec.Prepare();                  ec.NotifyOne();
+ *          if (!queue.Empty()) { ec.Cancel(); continue; }
+ *          ec.Wait(key);
+ *      }
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <thread>
+
+
+namespace threadpool
+{
+
+    class EventCount {
+
+    private:
+
+        std::atomic<uint32_t> epoch{0};
+        std::atomic<uint32_t> waiters{0};
+
+    public:
+
+        /**
+         * Announce an upcoming wait, the condition must be rechecked after this and before Wait
+         *
+         * @return the key to pass to Wait
+         */
+        uint32_t Prepare() {
+            waiters.fetch_add(1); // seq_cst, pairs with the waiters load in notify
+            return epoch.load();
+        }
+
+        /**
+         * The recheck found the condition true, leave without sleeping
+         */
+        void Cancel() {
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Sleep until a notification arrives after Prepare returned key
+         */
+        void Wait(uint32_t key) {
+            while (epoch.load(std::memory_order_acquire) == key) {
+                epoch.wait(key, std::memory_order_acquire);
+            }
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void NotifyOne() {
+            if (waiters.load() == 0) return; // nobody asleep or about to sleep, skip the syscall
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+
+        void NotifyAll() {
+            if (waiters.load() == 0) return;
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_all();
+        }
+
+        /**
+         * Wake up to n sleepers, all of them if n exceeds the number of waiters
+         */
+        void Notify(size_t n) {
+            size_t w = waiters.load();
+            if (w == 0) return;
+            epoch.fetch_add(1, std::memory_order_release);
+            if (n >= w) {
+                epoch.notify_all();
+            } else {
+                for (size_t i = 0; i < n; ++i) epoch.notify_one();
+            }
+        }
+
+        size_t Waiters() const {
+            return waiters.load(std::memory_order_relaxed);
+        }
+    };
+
+} // namespace threadpool
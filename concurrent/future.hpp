@@ -0,0 +1,439 @@
+/**
+ * Non-blocking futures with continuations
+ *
+ * Unlike std::future, a threadpool::Future can be chained: Then(fn) posts fn back onto the pool once the value is
+ * there, and WhenAll / WhenAny combine futures without parking a thread on any of them. The shared state is
+ * synchronized by one atomic flag word instead of a mutex and condition variable: whichever of the producer
+ * (setting the value) and the consumer (attaching a continuation) comes second sees the other's bit and runs the
+ * continuation, so it runs exactly once with no lock. Blocking Get is still available, it spins briefly and then
+ * parks on the flag word (a futex on Linux).
+ *
+ * Usage example:
+ *      auto f = pool.Async([] () -> int { return 21; })
+ *          .Then([] (int v) -> int { return v * 2; });
+ *      int v = f.Get();
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <variant>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <future>
+#include <functional>
+#include <type_traits>
+#include <tuple>
+#include <thread>
+
+#include "runnable.hpp"
+
+
+namespace threadpool
+{
+
+    /**
+     * Where continuations run: post hands a runnable to a pool, a null post runs it inline on the thread that
+     * completed the future
+     */
+    struct Executor {
+        void* ctx{nullptr};
+        void (*post)(void*, Runnable){nullptr};
+
+        void Run(Runnable task) const {
+            if (post) {
+                post(ctx, std::move(task));
+            } else {
+                task();
+            }
+        }
+    };
+
+    template<typename T>
+    class Future;
+
+    template<typename T>
+    class Promise;
+
+    namespace detail
+    {
+
+        template<typename T>
+        using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+        template<typename T>
+        struct State {
+
+            static constexpr int ready = 1;
+            static constexpr int attached = 2;
+
+            std::atomic<int> flags{0};
+            std::optional<Stored<T>> value;
+            std::exception_ptr error;
+            Runnable continuation;
+            Executor executor;
+
+            template<typename... U>
+            void SetValue(U&&... v) {
+                value.emplace(std::forward<U>(v)...);
+                publish();
+            }
+
+            void SetException(std::exception_ptr e) {
+                error = std::move(e);
+                publish();
+            }
+
+            /**
+             * Run c once the state is ready, on the completing thread (or right here if it is ready already)
+             */
+            void Subscribe(Runnable c) {
+                continuation = std::move(c);
+                if (flags.fetch_or(attached, std::memory_order_acq_rel) & ready) {
+                    Runnable run = std::move(continuation);
+                    run();
+                }
+            }
+
+            bool Ready() const {
+                return flags.load(std::memory_order_acquire) & ready;
+            }
+
+            void Wait() {
+                for (int i = 0; i < 64; ++i) {
+                    if (Ready()) return;
+                    std::this_thread::yield();
+                }
+                int f = flags.load(std::memory_order_acquire);
+                while (!(f & ready)) {
+                    flags.wait(f, std::memory_order_acquire);
+                    f = flags.load(std::memory_order_acquire);
+                }
+            }
+
+        private:
+
+            void publish() {
+                int prev = flags.fetch_or(ready, std::memory_order_acq_rel);
+                if (prev & attached) {
+                    Runnable run = std::move(continuation);
+                    run();
+                }
+                flags.notify_all();
+            }
+        };
+
+        template<typename T>
+        std::shared_ptr<State<T>> make(Executor executor) {
+            auto state = std::allocate_shared<State<T>>(PoolAllocator<State<T>>());
+            state->executor = executor;
+            return state;
+        }
+
+        /**
+         * Call fn with the value of a ready state and store the outcome in the promise, an error in the source
+         * skips fn and is forwarded as is
+         */
+        template<typename T, typename U, typename Fn>
+        void chain(State<T>& src, Promise<U>& dst, Fn& fn) {
+            if (src.error) {
+                dst.SetException(src.error);
+                return;
+            }
+            try {
+                if constexpr (std::is_void_v<T> && std::is_void_v<U>) {
+                    fn();
+                    dst.SetValue();
+                } else if constexpr (std::is_void_v<T>) {
+                    dst.SetValue(fn());
+                } else if constexpr (std::is_void_v<U>) {
+                    fn(std::move(*src.value));
+                    dst.SetValue();
+                } else {
+                    dst.SetValue(fn(std::move(*src.value)));
+                }
+            } catch (...) {
+                dst.SetException(std::current_exception());
+            }
+        }
+
+        template<typename T>
+        struct Then {
+            template<typename Fn>
+            using result = std::invoke_result_t<Fn, T>;
+        };
+
+        template<>
+        struct Then<void> {
+            template<typename Fn>
+            using result = std::invoke_result_t<Fn>;
+        };
+
+    } // namespace detail
+
+    /**
+     * Producer side of a Future, completing it more than once is undefined; dropping it unfulfilled completes the
+     * future with std::future_errc::broken_promise like std::promise does
+     */
+    template<typename T>
+    class Promise {
+
+    private:
+
+        std::shared_ptr<detail::State<T>> state;
+
+    public:
+
+        explicit Promise(Executor executor = {}) : state(detail::make<T>(executor)) {}
+
+        Promise(Promise&&) noexcept = default;
+        Promise& operator=(Promise&&) noexcept = default;
+
+        ~Promise() {
+            if (state && !state->Ready()) {
+                state->SetException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            }
+        }
+
+        Future<T> GetFuture() {
+            return Future<T>(state);
+        }
+
+        template<typename... U>
+        void SetValue(U&&... v) {
+            state->SetValue(std::forward<U>(v)...);
+        }
+
+        void SetException(std::exception_ptr e) {
+            state->SetException(std::move(e));
+        }
+    };
+
+    /**
+     * Consumer side, move-only and consumed by Get or Then
+     */
+    template<typename T>
+    class Future {
+
+    private:
+
+        template<typename U>
+        friend class Future;
+        friend class Promise<T>;
+
+        std::shared_ptr<detail::State<T>> state;
+
+        explicit Future(std::shared_ptr<detail::State<T>> s) : state(std::move(s)) {}
+
+    public:
+
+        Future() = default;
+
+        Future(Future&&) noexcept = default;
+        Future& operator=(Future&&) noexcept = default;
+
+        bool Valid() const {
+            return state != nullptr;
+        }
+
+        bool Ready() const {
+            return state->Ready();
+        }
+
+        /**
+         * Block until the value is there, prefer Then to keep the thread free
+         */
+        void Wait() const {
+            state->Wait();
+        }
+
+        /**
+         * Block for the value and take it, rethrows the stored exception
+         */
+        T Get() {
+            auto s = std::move(state);
+            s->Wait();
+            if (s->error) std::rethrow_exception(s->error);
+            if constexpr (!std::is_void_v<T>) return std::move(*s->value);
+        }
+
+        /**
+         * Attach a continuation: fn(value) is posted to the executor of this future once the value is there, a
+         * stored exception skips fn and propagates to the returned future
+         *
+         * @return a future of fn's result, bound to the same executor
+         */
+        template<typename Fn>
+        auto Then(Fn&& fn) -> Future<typename detail::Then<T>::template result<Fn>> {
+            using U = typename detail::Then<T>::template result<Fn>;
+            auto src = std::move(state);
+            Executor executor = src->executor;
+            Promise<U> dst(executor);
+            Future<U> res = dst.GetFuture();
+            struct Step {
+                std::shared_ptr<detail::State<T>> src;
+                Promise<U> dst;
+                std::decay_t<Fn> fn;
+
+                void operator()() {
+                    detail::chain(*src, dst, fn);
+                }
+
+                void Fail(std::exception_ptr e) {
+                    dst.SetException(std::move(e));
+                }
+            };
+            detail::State<T>* raw = src.get();
+            raw->Subscribe(Runnable([executor, step = Step{std::move(src), std::move(dst), std::forward<Fn>(fn)}]
+            () mutable -> void {
+                executor.Run(Runnable(std::move(step)));
+            }));
+            return res;
+        }
+
+        // internal: run c on the completing thread once ready, used by the combinators
+        void subscribe(Runnable c) {
+            state->Subscribe(std::move(c));
+        }
+
+        // internal: the ready state, only valid inside a subscribed callback
+        detail::State<T>& shared() {
+            return *state;
+        }
+
+        Executor executor() const {
+            return state->executor;
+        }
+    };
+
+    /**
+     * A future that is ready once every input is, holding their values in input order, or the first exception
+     */
+    template<typename T>
+    auto WhenAll(std::vector<Future<T>> futures)
+    -> Future<std::conditional_t<std::is_void_v<T>, void, std::vector<detail::Stored<T>>>> {
+        using R = std::conditional_t<std::is_void_v<T>, void, std::vector<detail::Stored<T>>>;
+        struct Join {
+            std::vector<Future<T>> inputs;
+            Promise<R> out;
+            std::atomic<size_t> left;
+
+            Join(std::vector<Future<T>> in, Executor e) : inputs(std::move(in)), out(e), left(inputs.size()) {}
+
+            void done() {
+                if (left.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+                // every input is ready and no other thread touches them any more
+                std::vector<detail::Stored<T>> values;
+                for (auto& f : inputs) {
+                    if (f.shared().error) {
+                        out.SetException(f.shared().error);
+                        return;
+                    }
+                    if constexpr (!std::is_void_v<T>) values.push_back(std::move(*f.shared().value));
+                }
+                if constexpr (std::is_void_v<T>) {
+                    out.SetValue();
+                } else {
+                    out.SetValue(std::move(values));
+                }
+            }
+        };
+        Executor executor = futures.empty() ? Executor{} : futures.front().executor();
+        auto join = std::make_shared<Join>(std::move(futures), executor);
+        auto res = join->out.GetFuture();
+        if (join->inputs.empty()) {
+            if constexpr (std::is_void_v<T>) {
+                join->out.SetValue();
+            } else {
+                join->out.SetValue(std::vector<detail::Stored<T>>());
+            }
+            return res;
+        }
+        for (auto& f : join->inputs) {
+            f.subscribe(Runnable([join] () -> void { join->done(); }));
+        }
+        return res;
+    }
+
+    /**
+     * A future that is ready as soon as any input is, holding the index of that input and its value (or its
+     * exception), the remaining inputs are left to complete on their own
+     */
+    template<typename T>
+    auto WhenAny(std::vector<Future<T>> futures) -> Future<std::pair<size_t, detail::Stored<T>>> {
+        using R = std::pair<size_t, detail::Stored<T>>;
+        struct Race {
+            std::vector<Future<T>> inputs;
+            Promise<R> out;
+            std::atomic<bool> won{false};
+
+            Race(std::vector<Future<T>> in, Executor e) : inputs(std::move(in)), out(e) {}
+
+            void done(size_t i) {
+                if (won.exchange(true, std::memory_order_acq_rel)) return;
+                auto& s = inputs[i].shared();
+                if (s.error) {
+                    out.SetException(s.error);
+                } else {
+                    out.SetValue(R(i, std::move(*s.value)));
+                }
+            }
+        };
+        if (futures.empty()) throw std::invalid_argument("WhenAny needs at least one future");
+        Executor executor = futures.front().executor();
+        auto race = std::make_shared<Race>(std::move(futures), executor);
+        auto res = race->out.GetFuture();
+        for (size_t i = 0; i < race->inputs.size(); ++i) {
+            race->inputs[i].subscribe(Runnable([race, i] () -> void { race->done(i); }));
+        }
+        return res;
+    }
+
+    namespace detail
+    {
+
+        /**
+         * Runnable body of FixedThreadPool::Async, the Future counterpart of Job
+         */
+        template<typename R, typename Fn, typename... Args>
+        struct AsyncJob {
+            Promise<R> promise;
+            Fn fn;
+            std::tuple<std::decay_t<Args>...> args;
+
+            template<typename A>
+            using pass = std::conditional_t<std::is_lvalue_reference_v<A>, std::decay_t<A>&, std::decay_t<A>&&>;
+
+            void operator()() {
+                try {
+                    if constexpr (std::is_void_v<R>) {
+                        call(std::index_sequence_for<Args...>());
+                        promise.SetValue();
+                    } else {
+                        promise.SetValue(call(std::index_sequence_for<Args...>()));
+                    }
+                } catch (...) {
+                    promise.SetException(std::current_exception());
+                }
+            }
+
+            void Fail(std::exception_ptr e) {
+                promise.SetException(std::move(e));
+            }
+
+            template<size_t... I>
+            decltype(auto) call(std::index_sequence<I...>) {
+                return std::invoke(std::move(fn), static_cast<pass<Args>>(std::get<I>(args))...);
+            }
+        };
+
+    } // namespace detail
+
+} // namespace threadpool
@@ -0,0 +1,441 @@
+/**
+ * Allocation-free building blocks for task submission
+ *
+ *      Runnable: a move-only type-erased void() callable with a small inline buffer, unlike std::function it never
+ *          copies and only touches the heap when the callable does not fit into the buffer
+ *      Ring: a growable circular buffer that keeps its storage, unlike std::deque which frees and reallocates
+ *          chunks as it is pushed at one end and popped at the other
+ *      PoolAllocator: a thread-local free list allocator, handed to std::promise so the shared state behind every
+ *          future is recycled instead of going through malloc, blocks freed on another thread find their way back
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <new>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <functional>
+
+#include <vector>
+#include <future>
+#include <tuple>
+#include <exception>
+
+
+namespace threadpool
+{
+
+    /**
+     * A move-only void() callable with small buffer optimization
+     *
+     * A callable may also provide Fail(std::exception_ptr), which is called instead of running it when the task is
+     * cancelled or rejected, so whoever waits on its result is completed with that exception.
+     */
+    class Runnable {
+
+    private:
+
+        static constexpr size_t capacity = 64;
+
+        struct Ops {
+            void (*invoke)(void*);
+            void (*move)(void* dst, void* src); // move construct into dst and destroy src
+            void (*destroy)(void*);
+            void (*fail)(void*, std::exception_ptr);
+        };
+
+        template<typename F>
+        static void failwith(F& f, std::exception_ptr e) {
+            if constexpr (requires { f.Fail(e); }) f.Fail(std::move(e));
+        }
+
+        template<typename F>
+        static constexpr bool fits = sizeof(F) <= capacity && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<F>;
+
+        template<typename F>
+        struct Inline {
+            static F* get(void* p) { return std::launder(reinterpret_cast<F*>(p)); }
+            static void invoke(void* p) { (*get(p))(); }
+            static void move(void* dst, void* src) { ::new (dst) F(std::move(*get(src))); get(src)->~F(); }
+            static void destroy(void* p) { get(p)->~F(); }
+            static void fail(void* p, std::exception_ptr e) { failwith(*get(p), std::move(e)); }
+            static constexpr Ops ops{invoke, move, destroy, fail};
+        };
+
+        template<typename F>
+        struct Boxed {
+            static F*& get(void* p) { return *std::launder(reinterpret_cast<F**>(p)); }
+            static void invoke(void* p) { (*get(p))(); }
+            static void move(void* dst, void* src) { ::new (dst) F*(get(src)); }
+            static void destroy(void* p) { delete get(p); }
+            static void fail(void* p, std::exception_ptr e) { failwith(*get(p), std::move(e)); }
+            static constexpr Ops ops{invoke, move, destroy, fail};
+        };
+
+        alignas(std::max_align_t) unsigned char buf[capacity];
+        const Ops* ops;
+
+    public:
+
+        Runnable() noexcept : ops(nullptr) {}
+
+        template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Runnable>>>
+        Runnable(F&& f) {
+            using Fn = std::decay_t<F>;
+            if constexpr (fits<Fn>) {
+                ::new (buf) Fn(std::forward<F>(f));
+                ops = &Inline<Fn>::ops;
+            } else {
+                ::new (buf) Fn*(new Fn(std::forward<F>(f)));
+                ops = &Boxed<Fn>::ops;
+            }
+        }
+
+        Runnable(Runnable&& other) noexcept : ops(other.ops) {
+            if (ops) {
+                ops->move(buf, other.buf);
+                other.ops = nullptr;
+            }
+        }
+
+        Runnable& operator=(Runnable&& other) noexcept {
+            if (this != &other) {
+                reset();
+                ops = other.ops;
+                if (ops) {
+                    ops->move(buf, other.buf);
+                    other.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        Runnable(const Runnable&) = delete;
+        Runnable& operator=(const Runnable&) = delete;
+
+        ~Runnable() {
+            reset();
+        }
+
+        explicit operator bool() const noexcept {
+            return ops != nullptr;
+        }
+
+        void operator()() {
+            ops->invoke(buf);
+        }
+
+        /**
+         * Complete the task with an exception instead of running it
+         */
+        void Fail(std::exception_ptr e) {
+            if (ops) ops->fail(buf, std::move(e));
+        }
+
+        void reset() noexcept {
+            if (ops) {
+                ops->destroy(buf);
+                ops = nullptr;
+            }
+        }
+    };
+
+
+    /**
+     * A growable circular buffer supporting push / pop at both ends, the storage only ever grows so a queue that
+     * has reached its working size never allocates again
+     */
+    template<typename T>
+    class Ring {
+
+    private:
+
+        std::vector<T> buf;
+        size_t head{0};
+        size_t count{0};
+
+    public:
+
+        bool empty() const {
+            return count == 0;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        T& front() {
+            return buf[head];
+        }
+
+        T& back() {
+            return buf[(head + count - 1) & (buf.size() - 1)];
+        }
+
+        // the i-th item from the front
+        T& at(size_t i) {
+            return buf[(head + i) & (buf.size() - 1)];
+        }
+
+        void push_back(T item) {
+            if (count == buf.size()) grow();
+            buf[(head + count) & (buf.size() - 1)] = std::move(item);
+            ++count;
+        }
+
+        void pop_front() {
+            buf[head] = T();
+            head = (head + 1) & (buf.size() - 1);
+            --count;
+        }
+
+        void pop_back() {
+            back() = T();
+            --count;
+        }
+
+    private:
+
+        void grow() {
+            std::vector<T> next(buf.empty() ? 16 : buf.size() * 2);
+            for (size_t i = 0; i < count; ++i) {
+                next[i] = std::move(buf[(head + i) & (buf.size() - 1)]);
+            }
+            buf.swap(next);
+            head = 0;
+        }
+    };
+
+
+    /**
+     * Thread-local free list of blocks of one size class
+     *
+     * Every block carries a header naming the list (the home) of the thread that allocated it, and a block always
+     * goes back to its home: freed on the owning thread it is pushed onto the owner's private list, freed anywhere
+     * else it is pushed onto the home's lock-free remote stack, which the owner takes over in one exchange once its
+     * private list runs dry. So a block made by a submitter and dropped by a worker is reused by the submitter, and a
+     * thread keeps as many blocks as it ever had in use at once until it exits.
+     *
+     * The cache pointer is a plain trivially destructible thread_local so it stays usable while other thread_locals
+     * are torn down, a separate guard object closes the home when the thread exits: cached blocks are returned to
+     * the system and blocks still in use elsewhere are deleted by whoever frees them. The home itself is reference
+     * counted by its thread and every block it made, so it lives until the last of them is gone.
+     */
+    template<size_t Size>
+    struct FreeList {
+
+        struct Home;
+
+        struct alignas(std::max_align_t) Block {
+            Home* home; // nullptr if the block was made after its thread closed its home
+            Block* next; // free blocks only
+        };
+
+        struct Home {
+            Block* head{nullptr}; // owner only
+            std::atomic<Block*> remote{nullptr}; // blocks freed by other threads
+            std::atomic<size_t> refs{1}; // the owning thread plus every block in existence
+        };
+
+        struct Cache {
+            Home* home;
+            bool closed;
+        };
+
+        // remote stack value of a home whose thread has exited, blocks freed after that are deleted
+        static Block* sealed() {
+            return reinterpret_cast<Block*>(alignof(Block));
+        }
+
+        struct Guard {
+            ~Guard() {
+                Cache& c = cache();
+                Home* h = c.home;
+                c.home = nullptr;
+                c.closed = true;
+                drop(h->head);
+                drop(h->remote.exchange(sealed(), std::memory_order_acquire));
+                release(h);
+            }
+        };
+
+        static Cache& cache() {
+            static thread_local Cache c{nullptr, false};
+            return c;
+        }
+
+        static void* allocate() {
+            Cache& c = cache();
+            if (!c.home && !c.closed) {
+                static thread_local Guard guard; // registered the first time this thread allocates a block
+                (void) guard;
+                c.home = new Home();
+            }
+            Home* h = c.home;
+            if (h) {
+                if (!h->head && h->remote.load(std::memory_order_relaxed)) {
+                    // take back what other threads have freed
+                    h->head = h->remote.exchange(nullptr, std::memory_order_acquire);
+                }
+                if (h->head) {
+                    Block* b = h->head;
+                    h->head = b->next;
+                    return b + 1;
+                }
+                h->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            Block* b = static_cast<Block*>(::operator new(sizeof(Block) + Size));
+            b->home = h;
+            return b + 1;
+        }
+
+        static void deallocate(void* p) {
+            Block* b = static_cast<Block*>(p) - 1;
+            Home* h = b->home;
+            if (!h) {
+                ::operator delete(b);
+                return;
+            }
+            if (h == cache().home) {
+                b->next = h->head;
+                h->head = b;
+                return;
+            }
+            Block* top = h->remote.load(std::memory_order_relaxed);
+            do {
+                if (top == sealed()) {
+                    destroy(b);
+                    return;
+                }
+                b->next = top;
+            } while (!h->remote.compare_exchange_weak(top, b, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+    private:
+
+        // delete a block and drop its reference on its home
+        static void destroy(Block* b) {
+            Home* h = b->home;
+            ::operator delete(b);
+            release(h);
+        }
+
+        // delete a list of blocks
+        static void drop(Block* list) {
+            while (list) {
+                Block* b = list;
+                list = b->next;
+                destroy(b);
+            }
+        }
+
+        static void release(Home* h) {
+            if (h->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete h;
+        }
+    };
+
+
+    /**
+     * Allocator that serves single objects from a thread-local FreeList of their size class
+     */
+    template<typename T>
+    struct PoolAllocator {
+
+        using value_type = T;
+
+        // round sizes up to 16 bytes so similar types share a list
+        static constexpr size_t size = (sizeof(T) + 15) / 16 * 16;
+        static constexpr bool pooled = alignof(T) <= alignof(std::max_align_t);
+
+        PoolAllocator() noexcept = default;
+
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+        T* allocate(size_t n) {
+            if (n == 1 && pooled) return static_cast<T*>(FreeList<size>::allocate());
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n) noexcept {
+            if (n == 1 && pooled) {
+                FreeList<size>::deallocate(p);
+                return;
+            }
+            ::operator delete(p);
+        }
+
+        template<typename U>
+        bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+
+        template<typename U>
+        bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+    };
+
+
+    /**
+     * A promise bundled with the callable and its bound arguments, invoking it fulfils the promise
+     *
+     * Arguments are stored decayed, an argument that was submitted as an lvalue is passed on as an lvalue and one
+     * submitted as an rvalue is moved into the call, which matches the invoke_result_t the future was typed with
+     * and lets move-only arguments through since the job runs exactly once.
+     */
+    template<typename R, typename Fn, typename... Args>
+    struct Job {
+        std::promise<R> promise;
+        Fn fn;
+        std::tuple<std::decay_t<Args>...> args;
+
+        template<typename A>
+        using pass = std::conditional_t<std::is_lvalue_reference_v<A>, std::decay_t<A>&, std::decay_t<A>&&>;
+
+        template<size_t... I>
+        decltype(auto) call(std::index_sequence<I...>) {
+            return std::invoke(std::move(fn), static_cast<pass<Args>>(std::get<I>(args))...);
+        }
+
+        void operator()() {
+            try {
+                if constexpr (std::is_void_v<R>) {
+                    call(std::index_sequence_for<Args...>());
+                    promise.set_value();
+                } else {
+                    promise.set_value(call(std::index_sequence_for<Args...>()));
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        void Fail(std::exception_ptr e) {
+            promise.set_exception(std::move(e));
+        }
+    };
+
+    /**
+     * Package a callable and its arguments into a Runnable plus the future of its result, the promise shared state
+     * comes from PoolAllocator so in the steady state no step of this touches malloc
+     *
+     * @param fut receives the future of the result
+     * @param fun the callable
+     * @param args the params passed to the callable
+     */
+    template<typename R, typename Func, typename... Args>
+    Runnable package(std::future<R>& fut, Func&& fun, Args&&... args) {
+        Job<R, std::decay_t<Func>, Args...> job{
+            std::promise<R>(std::allocator_arg, PoolAllocator<R>()),
+            std::forward<Func>(fun),
+            {std::forward<Args>(args)...}
+        };
+        fut = job.promise.get_future();
+        return Runnable(std::move(job));
+    }
+
+} // namespace threadpool
@@ -0,0 +1,142 @@
+/**
+ * Thread pool telemetry
+ *
+ * Every worker owns one cache-line aligned Counters block and is its only writer, so recording is a relaxed load
+ * and store per field with no read-modify-write and no sharing between cores. Readers aggregate the blocks with
+ * relaxed loads while the pool keeps running, the result is a consistent-enough view for a metrics pipeline.
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <bit>
+#include <vector>
+
+
+namespace stats
+{
+
+    /**
+     * Log-linear latency histogram in the style of HdrHistogram
+     *
+     * Values below 16 get one bucket each, above that every power of two is split into 8 linear sub-buckets, so
+     * any recorded value is reported with at most 12.5% relative error over the full 64-bit range in 496 buckets.
+     */
+    struct Histogram {
+
+        static constexpr size_t subbits = 3;
+        static constexpr size_t linear = size_t{1} << (subbits + 1); // values below this are exact
+        static constexpr size_t buckets = linear + (64 - subbits - 1) * (size_t{1} << subbits);
+
+        std::atomic<uint64_t> counts[buckets]{};
+
+        static size_t index(uint64_t v) {
+            if (v < linear) return static_cast<size_t>(v);
+            size_t e = std::bit_width(v) - 1;
+            size_t sub = static_cast<size_t>(v >> (e - subbits)) & ((size_t{1} << subbits) - 1);
+            return linear + (e - subbits - 1) * (size_t{1} << subbits) + sub;
+        }
+
+        // smallest value that falls into bucket i
+        static uint64_t lower(size_t i) {
+            if (i < linear) return i;
+            size_t e = (i - linear) / (size_t{1} << subbits) + subbits + 1;
+            uint64_t sub = (i - linear) % (size_t{1} << subbits);
+            return ((uint64_t{1} << subbits) + sub) << (e - subbits);
+        }
+
+        /**
+         * Record one value, only to be called by the owning thread
+         */
+        void record(uint64_t v) {
+            std::atomic<uint64_t>& c = counts[index(v)];
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Plain copy of one or more merged histograms
+     */
+    struct Distribution {
+
+        std::vector<uint64_t> counts = std::vector<uint64_t>(Histogram::buckets, 0);
+        uint64_t total{0};
+
+        void merge(const Histogram& h) {
+            for (size_t i = 0; i < Histogram::buckets; ++i) {
+                uint64_t c = h.counts[i].load(std::memory_order_relaxed);
+                counts[i] += c;
+                total += c;
+            }
+        }
+
+        /**
+         * Value at quantile q in [0, 1], reported as the lower bound of its bucket, 0 if nothing was recorded
+         */
+        uint64_t Percentile(double q) const {
+            if (total == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < Histogram::buckets; ++i) {
+                seen += counts[i];
+                if (seen >= rank) return Histogram::lower(i);
+            }
+            return Histogram::lower(Histogram::buckets - 1);
+        }
+    };
+
+    /**
+     * Per-worker counters, written only by the worker that owns them, times in nanoseconds
+     */
+    struct alignas(64) Counters {
+
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> busy{0};
+        std::atomic<uint64_t> idle{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> missed{0}; // tasks dropped because their deadline had passed
+
+        Histogram wait; // time from submission until a worker picked the task up
+        Histogram run; // time the task itself ran
+
+        static void add(std::atomic<uint64_t>& field, uint64_t v) {
+            field.store(field.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+    };
+
+    struct WorkerSnapshot {
+        uint64_t tasks{0};
+        uint64_t busy{0};
+        uint64_t idle{0};
+        uint64_t steals{0};
+        uint64_t missed{0};
+    };
+
+    /**
+     * Aggregated view of a pool, see FixedThreadPool::Snapshot
+     */
+    struct Snapshot {
+
+        std::vector<WorkerSnapshot> workers;
+        Distribution wait;
+        Distribution run;
+
+        void add(const Counters& c) {
+            WorkerSnapshot w;
+            w.tasks = c.tasks.load(std::memory_order_relaxed);
+            w.busy = c.busy.load(std::memory_order_relaxed);
+            w.idle = c.idle.load(std::memory_order_relaxed);
+            w.steals = c.steals.load(std::memory_order_relaxed);
+            w.missed = c.missed.load(std::memory_order_relaxed);
+            workers.push_back(w);
+            wait.merge(c.wait);
+            run.merge(c.run);
+        }
+    };
+
+} // namespace stats
@@ -0,0 +1,222 @@
+/**
+ * Task graph (DAG) executor on top of FixedThreadPool
+ *
+ * Nodes are posted to the pool as soon as their last predecessor finishes: every node keeps an atomic count of
+ * unfinished predecessors and the node that drops it to zero posts the successor, so no worker ever blocks on a
+ * future. The static structure (edges, in-degrees) is kept separately from the per-run counters, which are reset at
+ * the start of every Run, so one graph can be run again and again without rebuilding it.
+ *
+ * Usage example:
+ *      TaskGraph g;
+ *      auto load = g.Emplace([] () -> void { ... });
+ *      auto parse = g.Emplace([] () -> void { ... });
+ *      g.Precede(load, parse);
+ *      g.Run(pool).get();
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <future>
+#include <exception>
+#include <stdexcept>
+
+#include <mutex>
+
+#include "threadpool.hpp"
+
+
+namespace taskgraph
+{
+
+    struct Node {
+        std::function<void()> work;
+        std::vector<size_t> successors;
+        size_t indegree{0};
+        std::atomic<size_t> remaining{0}; // predecessors still to finish in the current run
+    };
+
+} // namespace taskgraph
+
+
+/**
+ * A reusable directed acyclic graph of tasks
+ */
+class TaskGraph {
+
+    using Node = taskgraph::Node;
+
+private:
+
+    std::vector<std::unique_ptr<Node>> nodes;
+
+    /**
+     * per-run state, shared with the posted runnables so a node finishing after Run's caller has dropped the
+     * future still finds it alive
+     */
+    struct Execution {
+        TaskGraph* graph;
+        FixedThreadPool* pool;
+        std::atomic<size_t> left; // nodes still to finish
+        std::promise<void> done;
+        std::mutex mtx;
+        std::exception_ptr error;
+    };
+
+    std::atomic<bool> active{false};
+    bool checked{false}; // the structure has been verified to be acyclic since the last change
+
+public:
+
+    TaskGraph() = default;
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    /**
+     * Add a node
+     *
+     * @param work the callable run for this node
+     * @return the node's id, used with Precede
+     */
+    template<typename Func>
+    size_t Emplace(Func&& work) {
+        auto node = std::make_unique<Node>();
+        node->work = std::forward<Func>(work);
+        nodes.push_back(std::move(node));
+        checked = false;
+        return nodes.size() - 1;
+    }
+
+    /**
+     * Add an edge: to runs only after from has finished
+     */
+    void Precede(size_t from, size_t to) {
+        nodes.at(from)->successors.push_back(to);
+        nodes.at(to)->indegree++;
+        checked = false;
+    }
+
+    size_t Size() const {
+        return nodes.size();
+    }
+
+    /**
+     * Submit the whole graph, source nodes are posted right away and every other node as soon as its
+     * predecessors are done. The graph must not be modified or destroyed until the returned future is ready, and
+     * only one run may be in flight at a time.
+     *
+     * If a node throws, its successors still run, the first exception is stored in the returned future.
+     *
+     * @return ready once every node has run
+     */
+    std::future<void> Run(FixedThreadPool& pool) {
+        if (active.exchange(true)) throw std::logic_error("task graph is already running");
+        auto run = std::make_shared<Execution>();
+        run->graph = this;
+        run->pool = &pool;
+        run->left = nodes.size();
+        std::future<void> res = run->done.get_future();
+        if (nodes.empty()) {
+            active = false;
+            run->done.set_value();
+            return res;
+        }
+        for (auto& node : nodes) {
+            node->remaining.store(node->indegree, std::memory_order_relaxed);
+        }
+        // collect sources first, a source may finish and post successors before the loop is over
+        std::vector<size_t> sources;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i]->indegree == 0) sources.push_back(i);
+        }
+        if (!checked && !acyclic()) {
+            active = false;
+            throw std::logic_error("task graph contains a cycle");
+        }
+        checked = true;
+        for (size_t i : sources) {
+            post(run, i);
+        }
+        return res;
+    }
+
+private: // helpers
+
+    // Kahn's algorithm on the static in-degrees, only rerun after the structure changed
+    bool acyclic() const {
+        std::vector<size_t> degree(nodes.size());
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            degree[i] = nodes[i]->indegree;
+            if (degree[i] == 0) ready.push_back(i);
+        }
+        size_t seen = 0;
+        while (!ready.empty()) {
+            size_t i = ready.back();
+            ready.pop_back();
+            ++seen;
+            for (size_t next : nodes[i]->successors) {
+                if (--degree[next] == 0) ready.push_back(next);
+            }
+        }
+        return seen == nodes.size();
+    }
+
+    struct Step {
+        std::shared_ptr<Execution> run;
+        size_t id;
+
+        void operator()() {
+            Node& node = *run->graph->nodes[id];
+            try {
+                node.work();
+            } catch (...) {
+                std::unique_lock<std::mutex> lock(run->mtx);
+                if (!run->error) run->error = std::current_exception();
+            }
+            for (size_t next : node.successors) {
+                // acq_rel: the last predecessor to finish sees every other predecessor's writes
+                if (run->graph->nodes[next]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    post(run, next);
+                }
+            }
+            finish(run);
+        }
+
+        // the pool refused the node, count it and its unreachable successors as failed so the run still ends
+        void Fail(std::exception_ptr e) {
+            {
+                std::unique_lock<std::mutex> lock(run->mtx);
+                if (!run->error) run->error = e;
+            }
+            for (size_t next : run->graph->nodes[id]->successors) {
+                if (run->graph->nodes[next]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    Step{run, next}.Fail(e);
+                }
+            }
+            finish(run);
+        }
+    };
+
+    static void post(const std::shared_ptr<Execution>& run, size_t id) {
+        run->pool->Post(threadpool::Runnable(Step{run, id}));
+    }
+
+    static void finish(const std::shared_ptr<Execution>& run) {
+        if (run->left.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        run->graph->active = false;
+        if (run->error) {
+            run->done.set_exception(run->error);
+        } else {
+            run->done.set_value();
+        }
+    }
+};
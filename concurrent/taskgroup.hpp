@@ -0,0 +1,188 @@
+/**
+ * Fork-join task groups on top of FixedThreadPool
+ *
+ * A task that submits subtasks and then blocks on their futures ties up a worker, and with recursive work every
+ * worker ends up waiting for tasks nobody is left to run. TaskGroup::Wait does not sleep while there is queued work:
+ * it first runs its own children that no thread has picked up yet, then other queued tasks of the pool, and only
+ * parks once nothing is left to help with, until its last child finishes.
+ *
+ * Running unrelated tasks nests their stack frames on top of the waiting one, so that kind of help stops at a fixed
+ * nesting depth. Parking there cannot deadlock: by then every child of the group has been picked up by some thread.
+ *
+ * Usage example:
+ *      long fib(FixedThreadPool& pool, int n) {
+ *          if (n < 2) return n;
+ *          long a, b;
+ *          TaskGroup g(pool);
+ *          g.Spawn([&] () -> void { a = fib(pool, n - 1); });
+ *          b = fib(pool, n - 2);
+ *          g.Wait();
+ *          return a + b;
+ *      }
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <utility>
+#include <type_traits>
+
+#include <mutex>
+
+#include "threadpool.hpp"
+
+
+namespace taskgroup
+{
+
+    /**
+     * Shared between the group and its children, so a child finishing after the group returned from Wait still 
+     * finds it alive
+     */
+    struct State {
+        std::atomic<size_t> remaining{0};
+        std::mutex mtx;
+        std::exception_ptr error;
+
+        void fail(std::exception_ptr e) {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!error) error = std::move(e);
+        }
+
+        void done() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) remaining.notify_all();
+        }
+    };
+
+    template<typename Func>
+    struct Child {
+        std::shared_ptr<State> state;
+        Func fn;
+
+        void operator()() {
+            try {
+                fn();
+            } catch (...) {
+                state->fail(std::current_exception());
+            }
+            state->done();
+        }
+
+        // the pool refused the child, it counts as finished with the pool's exception
+        void Fail(std::exception_ptr e) {
+            state->fail(std::move(e));
+            state->done();
+        }
+    };
+
+    /**
+     * A spawned child, run by whichever of the pool and the waiting group claims it first
+     */
+    struct Ticket {
+        std::atomic<bool> taken{false};
+        threadpool::Runnable work;
+
+        bool claim() {
+            return !taken.exchange(true, std::memory_order_acq_rel);
+        }
+    };
+
+    // what the pool runs for a child, a no-op once the group has run the child itself
+    struct Claim {
+        std::shared_ptr<Ticket> ticket;
+
+        void operator()() {
+            if (ticket->claim()) ticket->work();
+        }
+
+        void Fail(std::exception_ptr e) {
+            if (ticket->claim()) ticket->work.Fail(std::move(e));
+        }
+    };
+
+} // namespace taskgroup
+
+
+/**
+ * A set of tasks spawned on a pool and joined together
+ */
+class TaskGroup {
+
+private:
+
+    FixedThreadPool& pool;
+    std::shared_ptr<taskgroup::State> state;
+    std::vector<std::shared_ptr<taskgroup::Ticket>> children; // spawned since the last Wait
+
+    // how deep the calling thread is nested in helping with unrelated tasks
+    inline static thread_local size_t nesting = 0;
+    static constexpr size_t maxNesting = 16;
+
+public:
+
+    explicit TaskGroup(FixedThreadPool& p) : pool(p), state(std::make_shared<taskgroup::State>()) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * Joins the children that are still running, their exceptions are dropped
+     */
+    ~TaskGroup() {
+        join();
+    }
+
+    /**
+     * Submit fn to the pool as a child of this group, spawned from a worker in stealing mode it goes to that 
+     * worker's own deque. Not thread-safe, spawn from the thread that owns the group.
+     */
+    template<typename Func>
+    void Spawn(Func&& fn) {
+        state->remaining.fetch_add(1, std::memory_order_relaxed);
+        auto ticket = std::make_shared<taskgroup::Ticket>();
+        ticket->work = threadpool::Runnable(taskgroup::Child<std::decay_t<Func>>{state, std::forward<Func>(fn)});
+        children.push_back(ticket);
+        pool.Post(threadpool::Runnable(taskgroup::Claim{std::move(ticket)}));
+    }
+
+    /**
+     * Run queued tasks until every child has finished, then rethrow the first exception a child threw. The group 
+     * can be reused afterwards.
+     */
+    void Wait() {
+        join();
+        std::exception_ptr e;
+        {
+            std::unique_lock<std::mutex> lock(state->mtx);
+            e = std::exchange(state->error, nullptr);
+        }
+        if (e) std::rethrow_exception(e);
+    }
+
+private: // helpers
+
+    void join() {
+        // own children nobody has started yet, newest first like a sequential recursion would
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+            if ((*it)->claim()) (*it)->work();
+        }
+        children.clear();
+        while (size_t left = state->remaining.load(std::memory_order_acquire)) {
+            if (nesting < maxNesting) {
+                ++nesting;
+                bool helped = pool.RunPending();
+                --nesting;
+                if (helped) continue;
+            }
+            // nothing to help with, the remaining children are running on other threads
+            state->remaining.wait(left, std::memory_order_acquire);
+        }
+    }
+};
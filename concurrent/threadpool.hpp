@@ -26,20 +26,516 @@
 #include <memory>
 #include <thread>
 
-#include <queue>
 #include <functional>
+#include <iterator>
 
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 
-#include <iostream>
-
 #include <future>
 
 #include <vector>
 #include <chrono>
 
+#include <stdexcept>
+#include <algorithm>
+#include <latch>
+#include <coroutine>
+
+#include "runnable.hpp"
+#include "future.hpp"
+#include "trace.hpp"
+#include "stats.hpp"
+#include "affinity.hpp"
+#include "eventcount.hpp"
+
+
+namespace threadpool
+{
+
+    /**
+     * Scheduling mode of a fixed thread pool
+     *
+     * Shared: every worker takes tasks from one global queue guarded by a single mutex
+     * Stealing: every worker owns a deque, tasks submitted from inside a worker go to its own deque, and idle 
+     *      workers steal from the others, so the global queue is only touched by external submitters; a busy worker 
+     *      still looks at the global queue first whenever it holds a realtime or deadline task, and every 
+     *      threadpool::fairness own tasks otherwise, so neither mode lets local work starve the priority classes
+     */
+    enum class Mode {
+        Shared,
+        Stealing
+    };
+
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * How Shutdown treats the tasks that are still queued
+     *
+     * DrainAll: stop accepting new tasks, workers keep running until every queued task has run
+     * CancelPending: stop accepting new tasks, every queued task is completed with Cancelled and workers exit as 
+     *      soon as their current task returns
+     */
+    enum class ShutdownMode {
+        DrainAll,
+        CancelPending
+    };
+
+    /**
+     * Exception a queued task is completed with when the pool is shut down with CancelPending
+     */
+    struct Cancelled : std::runtime_error {
+        Cancelled() : std::runtime_error("task cancelled: thread pool shut down") {}
+    };
+
+    /**
+     * Exception a task is completed with when its deadline passed before a worker got to start it
+     */
+    struct DeadlineMissed : std::runtime_error {
+        DeadlineMissed() : std::runtime_error("task dropped: deadline passed before it started") {}
+    };
+
+    /**
+     * Exception a task is completed with when the pool refuses to queue it
+     */
+    struct Rejected : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * What a submission does when the pool already holds its capacity of queued tasks
+     *
+     * Block: the caller waits until a worker has taken a task off the queue
+     * CallerRuns: the task runs right away on the submitting thread, which slows the producer down
+     * DropOldest: the oldest task of the least urgent non-empty class is completed with Rejected to make room
+     * Reject: the new task is completed with Rejected, so its future holds the error
+     *
+     * A worker of the pool never blocks on its own pool, Block degrades to CallerRuns when submitting from one.
+     */
+    enum class Overflow {
+        Block,
+        CallerRuns,
+        DropOldest,
+        Reject
+    };
+
+    /**
+     * Queue bound of a FixedThreadPool
+     *
+     * capacity: the most tasks queued at once (in the priority queues and the worker deques), 0 for unbounded
+     * overflow: what happens to a submission beyond capacity
+     * watermark: fraction of capacity at which saturated is called, every time the queue grows past it
+     * saturated: backpressure hook, called with the queued count and the capacity on the submitting thread after 
+     *      the task is accounted for and with no lock of the pool held, so it may submit to the pool itself
+     */
+    struct Bounds {
+        size_t capacity{0};
+        Overflow overflow{Overflow::Block};
+        double watermark{0.9};
+        std::function<void(size_t, size_t)> saturated;
+    };
+
+    /**
+     * A queued task together with the time it was submitted, for queue wait telemetry
+     */
+    struct Entry {
+        Runnable fn;
+        clock::time_point enqueued;
+        clock::time_point deadline{clock::time_point::max()}; // max for tasks without a deadline
+        uint64_t tenant{0};
+
+        bool timed() const {
+            return deadline != clock::time_point::max();
+        }
+    };
+
+    /**
+     * Per-worker state used in stealing mode, the owner pushes and pops at the back while thieves take from the 
+     * front, so the owner keeps running the most recently spawned (cache hot) task
+     */
+    struct Worker {
+        std::mutex mtx;
+        Ring<Entry> local;
+        size_t pops{0}; // tasks taken from local in a row, owner only
+    };
+
+    /**
+     * Priority class of a task, lower value is more urgent
+     */
+    enum class Priority : size_t {
+        Realtime = 0,
+        Normal = 1,
+        Background = 2
+    };
+
+    inline constexpr size_t classes = 3;
+
+    // in stealing mode a worker checks the global queue at least once per this many tasks from its own deque
+    inline constexpr size_t fairness = 16;
+
+    /**
+     * Flow key of a task for weighted fair queueing, tasks submitted without one belong to tenant 0
+     */
+    struct Tenant {
+        uint64_t id{0};
+    };
+
+    /**
+     * Weighted fair queue of one priority class: a FIFO per tenant, served by deficit round-robin
+     *
+     * Active tenants take turns in a ring, a tenant at the head runs up to weight tasks in a row before it moves to 
+     * the back. Each task costs the same, so push and pop are O(1) however many tenants are active. A tenant's FIFO 
+     * is freed as soon as it runs empty unless it is tenant 0 or has a configured weight, so thousands of short-lived 
+     * tenants do not pile up while the default flow does not reallocate whenever it drains.
+     */
+    class Fair {
+
+    private:
+
+        struct Flow {
+            Ring<Entry> queue;
+            size_t weight{1};
+            size_t deficit{0}; // tasks left in the current turn
+            bool linked{false}; // in the active ring
+            bool keep{false}; // survives running empty
+        };
+
+        std::unordered_map<uint64_t, Flow> flows;
+        Ring<std::pair<uint64_t, Flow*>> active;
+        std::unordered_map<uint64_t, size_t> weights;
+
+    public:
+
+        bool empty() const {
+            return active.empty();
+        }
+
+        void push_back(Entry task) {
+            auto [it, fresh] = flows.try_emplace(task.tenant);
+            Flow& f = it->second;
+            if (fresh) {
+                auto w = weights.find(task.tenant);
+                if (w != weights.end()) f.weight = w->second;
+                f.keep = task.tenant == 0 || w != weights.end();
+            }
+            if (!f.linked) {
+                f.linked = true;
+                active.push_back({task.tenant, &f});
+            }
+            f.queue.push_back(std::move(task));
+        }
+
+        // the task pop would return next
+        Entry& front() {
+            return active.front().second->queue.front();
+        }
+
+        void pop(Entry& task) {
+            auto [tenant, f] = active.front();
+            if (f->deficit == 0) f->deficit = f->weight; // start of this tenant's turn
+            task = std::move(f->queue.front());
+            f->queue.pop_front();
+            --f->deficit;
+            if (f->queue.empty()) {
+                active.pop_front();
+                f->linked = false;
+                f->deficit = 0;
+                if (!f->keep) flows.erase(tenant);
+            } else if (f->deficit == 0) {
+                active.pop_front();
+                active.push_back({tenant, f});
+            }
+        }
+
+        /**
+         * Take the oldest task of the tenant with the longest backlog (the one queued first on a tie), for shedding 
+         * load; the order of the turns and the deficit of the tenant whose turn it is are left alone. O(tenants)
+         */
+        void drop(Entry& task) {
+            size_t victim = 0;
+            for (size_t i = 1; i < active.size(); ++i) {
+                Flow* a = active.at(i).second;
+                Flow* b = active.at(victim).second;
+                if (a->queue.size() > b->queue.size() || 
+                    (a->queue.size() == b->queue.size() && a->queue.front().enqueued < b->queue.front().enqueued)) {
+                    victim = i;
+                }
+            }
+            auto [tenant, f] = active.at(victim);
+            task = std::move(f->queue.front());
+            f->queue.pop_front();
+            if (!f->queue.empty()) return;
+            // unlink the drained tenant, rotating the ring once keeps everyone else in place
+            size_t n = active.size();
+            for (size_t i = 0; i < n; ++i) {
+                auto entry = active.front();
+                active.pop_front();
+                if (i != victim) active.push_back(entry);
+            }
+            f->linked = false;
+            f->deficit = 0;
+            if (!f->keep) flows.erase(tenant);
+        }
+
+        void weigh(uint64_t tenant, size_t weight) {
+            if (weight == 0) weight = 1;
+            weights[tenant] = weight;
+            auto it = flows.find(tenant);
+            if (it != flows.end()) {
+                it->second.weight = weight;
+                it->second.keep = true;
+            }
+        }
+    };
+
+    /**
+     * One weighted fair queue per priority class (a plain FIFO while everything is submitted without a tenant), 
+     * guarded by the pool mutex
+     *
+     * Workers do not always serve the most urgent non-empty class: they follow a fixed 16-step pattern that gives
+     * realtime 12, normal 3 and background 1 of every 16 picks, and only fall back to the most urgent non-empty 
+     * class when the preferred one is empty. A steady realtime stream therefore cannot starve the lower classes.
+     *
+     * Tasks with a deadline sit in a per-class min-heap next to the FIFO and are served earliest deadline first. 
+     * Within a class the two are merged on one key: a task without a deadline counts as due slack after it was 
+     * queued, so urgent deadlines go ahead of it while a stream of far-off deadlines cannot hold it back for longer 
+     * than slack.
+     */
+    struct Lanes {
+        static constexpr Priority pattern[16] = {
+            Priority::Realtime, Priority::Realtime, Priority::Realtime, Priority::Normal,
+            Priority::Realtime, Priority::Realtime, Priority::Realtime, Priority::Normal,
+            Priority::Realtime, Priority::Realtime, Priority::Realtime, Priority::Normal,
+            Priority::Realtime, Priority::Realtime, Priority::Realtime, Priority::Background,
+        };
+
+        // the effective deadline of a task without one, relative to when it was queued
+        static constexpr std::chrono::milliseconds slack{10};
+
+        Fair lanes[classes];
+        std::vector<Entry> edf[classes];
+        size_t size{0};
+        size_t cursor{0};
+
+        // per-class queue depth and its high-water mark, readable without the pool mutex
+        std::atomic<size_t> depth[classes]{};
+        std::atomic<size_t> peak[classes]{};
+        std::atomic<size_t> timed{0}; // tasks in the deadline heaps
+
+        bool empty() const {
+            return size == 0;
+        }
+
+        /**
+         * Something queued here must not wait behind a worker's own deque: a realtime task or a task with a deadline, 
+         * readable without the pool mutex
+         */
+        bool urgent() const {
+            return depth[static_cast<size_t>(Priority::Realtime)].load(std::memory_order_relaxed) != 0 || 
+                timed.load(std::memory_order_relaxed) != 0;
+        }
+
+        void push(Priority p, Entry task) {
+            size_t c = static_cast<size_t>(p);
+            if (task.timed()) {
+                edf[c].push_back(std::move(task));
+                std::push_heap(edf[c].begin(), edf[c].end(), later);
+                timed.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                lanes[c].push_back(std::move(task));
+            }
+            ++size;
+            size_t d = depth[c].fetch_add(1, std::memory_order_relaxed) + 1;
+            if (d > peak[c].load(std::memory_order_relaxed)) peak[c].store(d, std::memory_order_relaxed);
+        }
+
+        bool pop(Entry& task) {
+            if (size == 0) return false;
+            size_t c = static_cast<size_t>(pattern[cursor++ % 16]);
+            if (idle(c)) {
+                c = 0;
+                while (idle(c)) ++c;
+            }
+            if (!edf[c].empty() && (lanes[c].empty() || edf[c].front().deadline <= lanes[c].front().enqueued + slack)) {
+                take(c, task);
+            } else {
+                lanes[c].pop(task);
+            }
+            --size;
+            depth[c].fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // take the oldest task of the tenant with the longest backlog in the least urgent non-empty class, or the 
+        // latest deadline if the class only has timed tasks
+        bool drop(Entry& task) {
+            if (size == 0) return false;
+            size_t c = classes - 1;
+            while (idle(c)) --c;
+            if (!lanes[c].empty()) {
+                lanes[c].drop(task);
+            } else {
+                auto last = std::max_element(edf[c].begin(), edf[c].end(), [] (const Entry& a, const Entry& b) -> bool {
+                    return a.deadline < b.deadline;
+                });
+                task = std::move(*last);
+                *last = std::move(edf[c].back());
+                edf[c].pop_back();
+                std::make_heap(edf[c].begin(), edf[c].end(), later);
+                timed.fetch_sub(1, std::memory_order_relaxed);
+            }
+            --size;
+            depth[c].fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+    private:
+
+        // heap order, equal deadlines run in submission order
+        static bool later(const Entry& a, const Entry& b) {
+            return a.deadline != b.deadline ? a.deadline > b.deadline : a.enqueued > b.enqueued;
+        }
+
+        bool idle(size_t c) const {
+            return lanes[c].empty() && edf[c].empty();
+        }
+
+        void take(size_t c, Entry& task) {
+            std::pop_heap(edf[c].begin(), edf[c].end(), later);
+            task = std::move(edf[c].back());
+            edf[c].pop_back();
+            timed.fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Awaiter returned by FixedThreadPool::Schedule, resumes the coroutine through whatever post does with the 
+     * runnable it is handed
+     */
+    class Schedule {
+
+    private:
+
+        struct Resume {
+            std::coroutine_handle<> h;
+            std::exception_ptr* error;
+
+            void operator()() {
+                h.resume();
+            }
+
+            // the pool will not run us, resume anyway so the coroutine sees the exception instead of leaking
+            void Fail(std::exception_ptr e) {
+                *error = std::move(e);
+                h.resume();
+            }
+        };
+
+        std::function<void(Runnable)> post;
+        std::exception_ptr error;
+
+    public:
+
+        explicit Schedule(std::function<void(Runnable)> p) : post(std::move(p)) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            post(Runnable(Resume{h, &error}));
+        }
+
+        void await_resume() {
+            if (error) std::rethrow_exception(error);
+        }
+    };
+
+    /**
+     * Joinable handle for a group of chunks submitted together, the first exception thrown by any chunk is 
+     * rethrown from Wait
+     */
+    class Batch {
+
+    private:
+
+        struct State {
+            std::atomic<size_t> remaining;
+            std::mutex mtx;
+            std::condition_variable cond;
+            std::exception_ptr error;
+            bool done{false};
+
+            explicit State(size_t n) : remaining(n), done(n == 0) {}
+        };
+
+        std::shared_ptr<State> state;
+
+    public:
+
+        explicit Batch(size_t chunks) : state(std::make_shared<State>(chunks)) {}
+
+        /**
+         * Block until every chunk has run
+         */
+        void Wait() {
+            std::unique_lock<std::mutex> lock(state->mtx);
+            state->cond.wait(lock, [this] () -> bool { return state->done; });
+            if (state->error) std::rethrow_exception(state->error);
+        }
+
+        bool Done() const {
+            return state->remaining.load(std::memory_order_acquire) == 0;
+        }
+
+        /**
+         * Wrap a chunk body so that it reports its exception and its completion to this batch
+         */
+        template<typename Body>
+        Runnable Chunk(Body body) {
+            return Runnable(Part<Body>{state, std::move(body)});
+        }
+
+    private:
+
+        template<typename Body>
+        struct Part {
+            std::shared_ptr<State> s;
+            Body body;
+
+            void operator()() {
+                try {
+                    body();
+                } catch (...) {
+                    error(std::current_exception());
+                }
+                finish();
+            }
+
+            // a cancelled or rejected chunk still counts down, so Wait rethrows instead of hanging
+            void Fail(std::exception_ptr e) {
+                error(std::move(e));
+                finish();
+            }
+
+            void error(std::exception_ptr e) {
+                std::unique_lock<std::mutex> lock(s->mtx);
+                if (!s->error) s->error = std::move(e);
+            }
+
+            void finish() {
+                if (s->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::unique_lock<std::mutex> lock(s->mtx);
+                    s->done = true;
+                    s->cond.notify_all();
+                }
+            }
+        };
+    };
+
+} // namespace threadpool
+
 
 /**
  * A fixed thread pool implementation
@@ -49,6 +545,9 @@ class FixedThreadPool {
 private:
 
     const size_t core;
+    const threadpool::Mode mode;
+    const affinity::Policy placement;
+    const threadpool::Bounds bounds;
 
     /**
      * some operations on the map may require the stored type to be copyable or may invalidate references, 
@@ -57,46 +556,160 @@ private:
 
     std::unordered_map<int, std::unique_ptr<std::thread>> threads;
     
-    std::queue<std::function<void()>> tasks;
+    threadpool::Lanes tasks;
 
     std::mutex mtx;
-    std::condition_variable cond;
 
+    /**
+     * running: workers keep taking tasks, cleared by CancelPending to make them exit after their current task
+     * accepting: new tasks are queued, cleared by any Shutdown
+     * exited: workers that have left their loop, guarded by mtx and signalled on terminated
+     */
     std::atomic<bool> running;
+    std::atomic<bool> accepting;
+    size_t exited;
+    std::condition_variable terminated;
+
+    /**
+     * workers: the per-worker deques, stealing mode only
+     * pending: the number of tasks queued anywhere in the pool, reserved before the push so it never undercounts
+     * events: idle workers park here, a push only issues the wake syscall when a worker is actually parked
+     * blocked / space: submitters waiting for room under Overflow::Block, a worker only takes mtx to wake them 
+     *      when there are any
+     */
+    std::vector<std::unique_ptr<threadpool::Worker>> workers;
+    std::atomic<size_t> pending;
+    threadpool::EventCount events;
+    std::atomic<size_t> blocked;
+    std::condition_variable space;
+
+    /**
+     * per-worker state is allocated by the worker itself after it has been pinned, so with first-touch the pages 
+     * land on the worker's own node; the constructor waits on ready until every worker has done so
+     */
+    std::vector<std::unique_ptr<stats::Counters>> counters;
+    std::latch ready;
+
+    // numa node of every worker, and per worker the steal victims ordered same node first
+    std::vector<int> nodes;
+    std::vector<std::vector<size_t>> victims;
+    std::atomic<size_t> spread; // round-robin cursor for ExecLocal
+
+    // the pool and worker index of the calling thread, nullptr if it is not a pool worker
+    inline static thread_local FixedThreadPool* owner = nullptr;
+    inline static thread_local size_t self = 0;
 
 public:
 
-    FixedThreadPool(size_t c) : core(c), running(false) {
+    /**
+     * @param c the number of workers
+     * @param m shared queue or work stealing
+     * @param p where to pin the workers, see affinity::Placement
+     * @param b queue capacity and what to do beyond it, see threadpool::Overflow
+     */
+    FixedThreadPool(size_t c, threadpool::Mode m = threadpool::Mode::Shared, affinity::Policy p = {}, 
+        threadpool::Bounds b = {}) 
+    : core(c), mode(m), placement(std::move(p)), bounds(std::move(b)), running(false), accepting(false), exited(0), 
+      pending(0), blocked(0), counters(c), ready(static_cast<std::ptrdiff_t>(c)), spread(0) {
         running = true;
+        accepting = true;
+        if (mode == threadpool::Mode::Stealing) {
+            workers.resize(core);
+        }
+        for (size_t i = 0; i < core; ++i) {
+            std::vector<int> cpus = affinity::CpusFor(placement, i);
+            nodes.push_back(cpus.empty() ? 0 : affinity::Discover().NodeOf(cpus.front()));
+        }
+        for (size_t i = 0; i < core; ++i) {
+            std::vector<size_t> order;
+            for (size_t pass = 0; pass < 2; ++pass) {
+                for (size_t j = 1; j < core; ++j) {
+                    size_t v = (i + j) % core;
+                    if ((nodes[v] == nodes[i]) == (pass == 0)) order.push_back(v);
+                }
+            }
+            victims.push_back(std::move(order));
+        }
         for (size_t i = 0; i < core; ++i) {
             auto threadptr = std::make_unique<std::thread>(&FixedThreadPool::threadfunc, this, i);
             threads.emplace(i, std::move(threadptr));
-            std::cout << "Thread - " << i << " is created by fixed thread pool." << std::endl;
+            trace::Emit<trace::Level::Info>("thread is created by fixed thread pool", i);
         }
+        ready.wait();
     }
 
+    /**
+     * Cancels whatever is still queued unless Shutdown(DrainAll) was called before, in which case the queued tasks 
+     * are drained first
+     */
     ~FixedThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            running = false;
-            cond.notify_all();
+        if (accepting) {
+            Shutdown(threadpool::ShutdownMode::CancelPending);
         }
         for (auto& [id, t]: threads) {
             if (t->joinable()) {
                 t->join();
-                std::cout << "Thread - " << id << " joins." << std::endl;
+                trace::Emit<trace::Level::Info>("thread joins", id);
             }
         }
+        // tasks that raced with the shutdown and were queued after the last worker left
+        cancel();
     }
 
     /**
-     * Execute the given command by submitting it to the thread pool's task queue.
+     * Stop accepting tasks, Exec afterwards returns a future holding threadpool::Rejected.
+     * 
+     * @param how DrainAll runs every queued task before the workers exit, CancelPending completes every queued task 
+     *      with threadpool::Cancelled and lets the workers exit after their current task
+     */
+    void Shutdown(threadpool::ShutdownMode how = threadpool::ShutdownMode::DrainAll) {
+        accepting = false;
+        if (how == threadpool::ShutdownMode::CancelPending) running = false;
+        events.NotifyAll();
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            space.notify_all();
+        }
+        if (how == threadpool::ShutdownMode::CancelPending) cancel();
+    }
+
+    /**
+     * Block until every worker has exited after Shutdown, or until the timeout expires.
+     * 
+     * @return true if the pool has terminated
+     */
+    template<typename Rep, typename Period>
+    bool AwaitTermination(std::chrono::duration<Rep, Period> timeout) {
+        std::unique_lock<std::mutex> lock(mtx);
+        return terminated.wait_for(lock, timeout, [this] () -> bool { return exited == core; });
+    }
+
+    /**
+     * Execute the given command at normal priority.
      * 
      * @param fun the runnable
      * @param args the params passed to the runnable
      */
     template<typename Func, typename... Args>
     auto Exec(Func&& fun, Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
+        return Exec(threadpool::Priority::Normal, std::forward<Func>(fun), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Execute the given command by submitting it to the thread pool's task queue.
+     * 
+     * In stealing mode a normal priority task submitted from one of this pool's workers goes to that worker's own 
+     * deque, every other task goes to the queue of its priority class. A queued realtime task is picked up by the 
+     * next worker to finish a task in either mode, normal and background tasks wait behind at most 
+     * threadpool::fairness tasks of a busy worker's own deque.
+     * 
+     * @param priority the priority class of the task
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto Exec(threadpool::Priority priority, Func&& fun, Args&&... args) 
+    -> std::future<std::invoke_result_t<Func, Args...>> {
         /**
          * choose invoke result instead of decltype because decltype doesn’t work well with template parameters 
          * representing generic callables, especially if those callables have overloaded or templated operator() 
@@ -109,130 +722,804 @@ public:
          * object if a move constructor or move assignment is available, then if not possible, fall back to copy
          */
         using return_type = std::invoke_result_t<Func, Args...>;
-        // return default zero value when thread pool is not running
-        if (!running) {
-            std::cerr << "Failed to execute: fixed thread pool is no longer running." << std::endl;
-            std::promise<return_type> p;
-            p.set_value(return_type{});
-            return p.get_future();
-        }
-        // package task
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<Func>(fun), std::forward<Args>(args)...)
-        );
+        // package task, the callable and the promise live inside the runnable and the shared state is pooled
+        std::future<return_type> res;
+        threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
         // enqueue
+        Post(std::move(task), priority);
+        // return result
+        return res;
+    }
+
+    /**
+     * Execute the given command on behalf of a tenant.
+     * 
+     * Within a priority class every tenant has its own queue and the workers serve the tenants with backlog in 
+     * turns, each running up to its weight of tasks per turn (see SetWeight), so one tenant flooding the pool only 
+     * delays its own tasks. Tasks submitted without a tenant form tenant 0.
+     * 
+     * @param tenant the flow the task is accounted to
+     * @param priority the priority class of the task
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto Exec(threadpool::Tenant tenant, threadpool::Priority priority, Func&& fun, Args&&... args) 
+    -> std::future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        std::future<return_type> res;
+        threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
+        Post(std::move(task), priority, threadpool::clock::time_point::max(), tenant);
+        return res;
+    }
+
+    template<typename Func, typename... Args>
+    auto Exec(threadpool::Tenant tenant, Func&& fun, Args&&... args) 
+    -> std::future<std::invoke_result_t<Func, Args...>> {
+        return Exec(tenant, threadpool::Priority::Normal, std::forward<Func>(fun), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Set how many tasks a tenant may run per turn relative to the others, 1 by default
+     */
+    void SetWeight(threadpool::Tenant tenant, size_t weight) {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (auto& lane : tasks.lanes) lane.weigh(tenant.id, weight);
+    }
+
+    /**
+     * Execute the given command unless its deadline passes first.
+     * 
+     * Tasks with a deadline are served earliest deadline first within their priority class, a task of that class 
+     * without one counts as due threadpool::Lanes::slack after it was queued. They always go through the priority 
+     * queues, which busy stealing workers check ahead of their own deques, so the order holds in stealing mode too. A 
+     * task whose deadline has passed when a worker picks it up is not run, its future holds 
+     * threadpool::DeadlineMissed and the miss is counted in the worker's stats.
+     * 
+     * @param deadline the latest time the task may start
+     * @param priority the priority class of the task
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto ExecBefore(threadpool::clock::time_point deadline, threadpool::Priority priority, Func&& fun, 
+        Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        std::future<return_type> res;
+        threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
+        Post(std::move(task), priority, deadline);
+        return res;
+    }
+
+    template<typename Func, typename... Args>
+    auto ExecBefore(threadpool::clock::time_point deadline, Func&& fun, Args&&... args) 
+    -> std::future<std::invoke_result_t<Func, Args...>> {
+        return ExecBefore(deadline, threadpool::Priority::Normal, std::forward<Func>(fun), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Execute the given command and return a non-blocking threadpool::Future of its result, continuations attached 
+     * with Then run on this pool.
+     * 
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto Async(Func&& fun, Args&&... args) -> threadpool::Future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        threadpool::Promise<return_type> promise(AsExecutor());
+        threadpool::Future<return_type> res = promise.GetFuture();
+        Post(threadpool::Runnable(threadpool::detail::AsyncJob<return_type, std::decay_t<Func>, Args...>{
+            std::move(promise), std::forward<Func>(fun), {std::forward<Args>(args)...}
+        }));
+        return res;
+    }
+
+    /**
+     * This pool as an executor for threadpool::Promise / Future continuations
+     */
+    threadpool::Executor AsExecutor() {
+        return threadpool::Executor{this, [] (void* pool, threadpool::Runnable task) -> void {
+            static_cast<FixedThreadPool*>(pool)->Post(std::move(task));
+        }};
+    }
+
+    /**
+     * Queue a runnable without a future, for callers that bring their own completion mechanism (coroutines, 
+     * continuations). When the pool is shut down the runnable is failed with threadpool::Rejected instead, when it 
+     * is full the overflow policy of its threadpool::Bounds applies. Nobody waits on a bare runnable, an exception 
+     * escaping it is traced at Error level and dropped rather than taking the process down.
+     * 
+     * @param task the runnable
+     * @param priority the priority class of the task
+     * @param deadline the latest time the task may start, see ExecBefore
+     * @param tenant the flow the task is accounted to, see Exec(Tenant, ...)
+     */
+    void Post(threadpool::Runnable task, threadpool::Priority priority = threadpool::Priority::Normal, 
+        threadpool::clock::time_point deadline = threadpool::clock::time_point::max(), threadpool::Tenant tenant = {}) {
+        // complete the task with an exception when thread pool is shut down
+        if (!accepting) {
+            trace::Emit<trace::Level::Warn>("failed to execute: fixed thread pool is no longer running");
+            task.Fail(std::make_exception_ptr(threadpool::Rejected("fixed thread pool is no longer running")));
+            return;
+        }
+        if (!reserve()) {
+            overflow(priority, {std::move(task), threadpool::clock::now(), deadline, tenant.id});
+            return;
+        }
+        submit(priority, {std::move(task), threadpool::clock::now(), deadline, tenant.id});
+    }
+
+    /**
+     * Awaitable that moves the awaiting coroutine onto one of this pool's workers.
+     * 
+     * Usage example:
+     *      co_await pool.Schedule();
+     * 
+     * Throws threadpool::Rejected or threadpool::Cancelled from the co_await if the pool is shut down before the 
+     * coroutine got to run, the coroutine is then resumed on the thread that shut the pool down.
+     */
+    threadpool::Schedule Schedule(threadpool::Priority priority = threadpool::Priority::Normal) {
+        return threadpool::Schedule(
+            [this, priority] (threadpool::Runnable task) -> void { Post(std::move(task), priority); }
+        );
+    }
+
+    /**
+     * Run one queued task on the calling thread, so a thread waiting for work it has submitted can help instead of 
+     * blocking. A worker of this pool looks in the same places as when it is idle (own deque first), any other 
+     * thread takes from the priority queues and, in stealing mode, steals from the worker deques.
+     * 
+     * @return false if nothing was queued
+     */
+    bool RunPending() {
+        if (!running || pending.load() == 0) return false;
+        threadpool::Entry task;
+        if (owner == this) {
+            threadpool::clock::time_point idle = threadpool::clock::now();
+            if (!take(self, task)) return false;
+            release(1);
+            run(self, task, idle);
+            return true;
+        }
+        bool found = false;
         {
             std::unique_lock<std::mutex> lock(mtx);
-            tasks.emplace([task] () -> void { (*task)(); }); // captures task by value, holds a copy of the shared_ptr
-            cond.notify_one();
+            found = tasks.pop(task);
         }
-        // return result
-        return task->get_future();
+        for (size_t v = 0; !found && v < workers.size(); ++v) {
+            std::unique_lock<std::mutex> lock(workers[v]->mtx, std::try_to_lock);
+            if (lock.owns_lock() && !workers[v]->local.empty()) {
+                task = std::move(workers[v]->local.front());
+                workers[v]->local.pop_front();
+                found = true;
+            }
+        }
+        if (!found) return false;
+        release(1);
+        if (threadpool::clock::now() > task.deadline) {
+            task.fn.Fail(std::make_exception_ptr(threadpool::DeadlineMissed()));
+        } else {
+            invoke(task.fn);
+        }
+        return true;
+    }
+
+    /**
+     * Execute the given command on a worker of the caller's numa node.
+     * 
+     * In stealing mode the task goes to the deque of a worker on the node the caller is running on, so it runs near 
+     * the memory the caller just touched unless an idle worker of another node steals it. In shared mode, or when no 
+     * worker sits on the caller's node, this is the same as Exec.
+     * 
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto ExecLocal(Func&& fun, Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        if (mode != threadpool::Mode::Stealing || owner == this || !accepting) {
+            return Exec(std::forward<Func>(fun), std::forward<Args>(args)...);
+        }
+        int node = affinity::CurrentNode();
+        size_t start = spread.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < core; ++i) {
+            size_t target = (start + i) % core;
+            if (nodes[target] != node) continue;
+            if (!reserve()) break; // full, let Exec apply the overflow policy
+            std::future<return_type> res;
+            threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
+            {
+                threadpool::Worker& w = *workers[target];
+                std::unique_lock<std::mutex> lock(w.mtx);
+                w.local.push_back({std::move(task), threadpool::clock::now()});
+            }
+            events.NotifyOne();
+            return res;
+        }
+        return Exec(std::forward<Func>(fun), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Apply fn to every element of range, split into at most one chunk per worker.
+     * 
+     * All chunks are enqueued under one lock acquisition and exactly as many workers are woken as there are chunks. 
+     * The range must outlive the batch.
+     * 
+     * @param range any range with begin / end iterators
+     * @param fn invoked with each element
+     * @return a handle to wait for the whole batch
+     */
+    template<typename Range, typename Func>
+    threadpool::Batch ExecBatch(Range& range, Func&& fn) {
+        using iterator = decltype(std::begin(range));
+        size_t n = static_cast<size_t>(std::distance(std::begin(range), std::end(range)));
+        size_t chunks = n < core ? n : core;
+        threadpool::Batch batch(chunks);
+        if (chunks == 0) return batch;
+        auto body = std::make_shared<std::decay_t<Func>>(std::forward<Func>(fn));
+        iterator first = std::begin(range);
+        enqueue(chunks, [&, size = n / chunks, extra = n % chunks] (size_t i) -> threadpool::Runnable {
+            iterator last = std::next(first, size + (i < extra ? 1 : 0));
+            threadpool::Runnable chunk = batch.Chunk([body, first, last] () -> void {
+                for (iterator it = first; it != last; ++it) (*body)(*it);
+            });
+            first = last;
+            return chunk;
+        });
+        return batch;
+    }
+
+    /**
+     * Invoke fn(i) for every i in [begin, end), in chunks of grain indices.
+     * 
+     * All chunks are enqueued under one lock acquisition and at most one worker per chunk is woken.
+     * 
+     * @param begin the first index
+     * @param end one past the last index
+     * @param grain the number of indices per chunk
+     * @param fn invoked with each index
+     * @return a handle to wait for the whole batch
+     */
+    template<typename Index, typename Func>
+    threadpool::Batch ParallelFor(Index begin, Index end, size_t grain, Func&& fn) {
+        if (grain == 0) grain = 1;
+        size_t n = end > begin ? static_cast<size_t>(end - begin) : 0;
+        size_t chunks = (n + grain - 1) / grain;
+        threadpool::Batch batch(chunks);
+        if (chunks == 0) return batch;
+        auto body = std::make_shared<std::decay_t<Func>>(std::forward<Func>(fn));
+        enqueue(chunks, [&] (size_t i) -> threadpool::Runnable {
+            Index first = begin + static_cast<Index>(i * grain);
+            Index last = i + 1 == chunks ? end : first + static_cast<Index>(grain);
+            return batch.Chunk([body, first, last] () -> void {
+                for (Index j = first; j < last; ++j) (*body)(j);
+            });
+        });
+        return batch;
+    }
+
+    /**
+     * Number of workers
+     */
+    size_t Size() const {
+        return core;
+    }
+
+    /**
+     * Number of tasks currently queued in the given priority class, tasks sitting in stealing mode worker deques 
+     * are not counted
+     */
+    size_t Depth(threadpool::Priority priority) const {
+        return tasks.depth[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Highest queue depth the given priority class has reached since the pool started
+     */
+    size_t PeakDepth(threadpool::Priority priority) const {
+        return tasks.peak[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Queued tasks as a fraction of the capacity, 0 for an unbounded pool; may exceed 1 briefly since batches are 
+     * not bounded
+     */
+    double Saturation() const {
+        if (bounds.capacity == 0) return 0.0;
+        return static_cast<double>(pending.load(std::memory_order_relaxed)) / static_cast<double>(bounds.capacity);
+    }
+
+    /**
+     * Aggregate the per-worker counters and latency histograms without stopping the pool, values of tasks that 
+     * finish during the call may or may not be included
+     */
+    stats::Snapshot Snapshot() const {
+        stats::Snapshot snap;
+        for (size_t i = 0; i < core; ++i) {
+            snap.add(*counters[i]);
+        }
+        return snap;
     }
 
 private: // helpers
 
     void threadfunc(int id) {
-        while (true) {
-            std::function<void()> task;
-            // take task out of task queue
-            {
-                std::unique_lock<std::mutex> lock(mtx);
-                cond.wait(lock, [this] () -> bool { return !running || !tasks.empty(); }); // dangling ptr of this
-                if (!running) break;
-                task = tasks.front();
-                tasks.pop();
-            }
-            // exec the task
-            std::cout << "FixedThread - " << id << " is executing task." << std::endl;
-            task();
+        // pin first, then allocate this worker's state so that it is first touched on the worker's node
+        affinity::Pin(affinity::CpusFor(placement, id));
+        counters[id] = std::make_unique<stats::Counters>();
+        if (mode == threadpool::Mode::Stealing) {
+            workers[id] = std::make_unique<threadpool::Worker>();
+        }
+        ready.count_down();
+        ready.wait(); // stealing needs every worker's deque to exist
+        owner = this;
+        self = id;
+        threadpool::clock::time_point idle = threadpool::clock::now();
+        size_t spin = spinMin;
+        while (running) {
+            threadpool::Entry task;
+            if (pending.load() > 0 && take(id, task)) {
+                release(1);
+                run(id, task, idle);
+                idle = threadpool::clock::now();
+                continue;
+            }
+            if (!accepting && pending.load() == 0) break; // shut down and drained
+            // nothing found, spin for a while in case a task arrives shortly, then park until one is pushed
+            if (poll(spin)) {
+                spin = spin * 2 < spinMax ? spin * 2 : spinMax; // spinning paid off, spin longer next time
+                continue;
+            }
+            spin = spin / 2 > spinMin ? spin / 2 : spinMin;
+            uint32_t key = events.Prepare();
+            // recheck after announcing ourselves, pairs with the waiter count load in wake
+            if (!idling()) {
+                events.Cancel();
+                continue;
+            }
+            events.Wait(key);
+        }
+        owner = nullptr;
+        retire();
+    }
+
+    // adaptive spin budget of an idle worker before it parks, in polls of the pending count
+    static constexpr size_t spinMin = 16;
+    static constexpr size_t spinMax = 1024;
+
+    // nothing is queued and the pool keeps running
+    bool idling() const {
+        return running && accepting && pending.load() == 0;
+    }
+
+    /**
+     * Poll for work up to spin times, yielding the cpu every few polls
+     * 
+     * @return true if there is something to do
+     */
+    bool poll(size_t spin) {
+        for (size_t i = 0; i < spin; ++i) {
+            if (!idling()) return true;
+            if (i % 8 == 7) std::this_thread::yield();
+        }
+        return false;
+    }
+
+    // called by every worker as it leaves its loop
+    void retire() {
+        std::unique_lock<std::mutex> lock(mtx);
+        ++exited;
+        terminated.notify_all();
+    }
+
+    /**
+     * Take every queued task out of the pool and complete it with threadpool::Cancelled
+     */
+    void cancel() {
+        std::vector<threadpool::Entry> dropped;
+        threadpool::Entry task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (tasks.pop(task)) dropped.push_back(std::move(task));
+        }
+        for (auto& w : workers) {
+            if (!w) continue;
+            std::unique_lock<std::mutex> lock(w->mtx);
+            while (!w->local.empty()) {
+                dropped.push_back(std::move(w->local.front()));
+                w->local.pop_front();
+            }
+        }
+        release(dropped.size());
+        if (!dropped.empty()) trace::Emit<trace::Level::Info>("cancelled queued tasks", dropped.size());
+        for (auto& t : dropped) {
+            t.fn.Fail(std::make_exception_ptr(threadpool::Cancelled()));
+        }
+    }
+
+    /**
+     * Run a task and account for it in the worker's counters
+     * 
+     * @param idle when the worker started looking for this task
+     */
+    /**
+     * Run a task's runnable, packaged tasks keep their exceptions in their futures but one escaping a bare runnable 
+     * has nowhere to go: trace it instead of letting it terminate the worker
+     */
+    static void invoke(threadpool::Runnable& fn, int worker = -1) {
+        try {
+            fn();
+        } catch (...) {
+            trace::Emit<trace::Level::Error>("posted task threw an exception, dropped", 0, worker);
         }
     }
+
+    void run(size_t id, threadpool::Entry& task, threadpool::clock::time_point idle) {
+        stats::Counters& c = *counters[id];
+        threadpool::clock::time_point start = threadpool::clock::now();
+        if (start > task.deadline) {
+            // too late to be of any use, skip the work
+            stats::Counters::add(c.missed, 1);
+            trace::Emit<trace::Level::Debug>("task missed its deadline", 0, static_cast<int>(id));
+            task.fn.Fail(std::make_exception_ptr(threadpool::DeadlineMissed()));
+            return;
+        }
+        trace::Emit<trace::Level::Debug>("executing task", 0, static_cast<int>(id));
+        invoke(task.fn, static_cast<int>(id));
+        threadpool::clock::time_point end = threadpool::clock::now();
+        auto ns = [] (threadpool::clock::duration d) -> uint64_t {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+        };
+        stats::Counters::add(c.tasks, 1);
+        stats::Counters::add(c.busy, ns(end - start));
+        stats::Counters::add(c.idle, ns(start - idle));
+        c.wait.record(ns(start - task.enqueued));
+        c.run.record(ns(end - start));
+    }
+
+    /**
+     * Enqueue n normal priority tasks built by make(i) under a single lock acquisition, then wake one worker per 
+     * task (all of them if there are more tasks than workers)
+     */
+    template<typename Make>
+    void enqueue(size_t n, Make make) {
+        // nobody would ever run the tasks, fail them so that waiting on the batch cannot hang
+        if (!accepting) {
+            trace::Emit<trace::Level::Warn>("failed to execute: fixed thread pool is no longer running");
+            for (size_t i = 0; i < n; ++i) {
+                make(i).Fail(std::make_exception_ptr(threadpool::Rejected("fixed thread pool is no longer running")));
+            }
+            return;
+        }
+        // batches are not bounded: their size is fixed by the caller and they are waited for as a whole
+        pending.fetch_add(n);
+        {
+            threadpool::clock::time_point now = threadpool::clock::now();
+            std::unique_lock<std::mutex> lock(mtx);
+            for (size_t i = 0; i < n; ++i) {
+                tasks.push(threadpool::Priority::Normal, {make(i), now});
+            }
+        }
+        events.Notify(n);
+    }
+
+    /**
+     * Enqueue a task whose slot has been reserved: in stealing mode onto the caller's own deque if it is a normal 
+     * priority task without a deadline or tenant and the caller is one of our workers, otherwise onto the global 
+     * queue of its priority class
+     */
+    void submit(threadpool::Priority priority, threadpool::Entry task) {
+        if (mode == threadpool::Mode::Stealing && owner == this && priority == threadpool::Priority::Normal && 
+            !task.timed() && task.tenant == 0) {
+            threadpool::Worker& w = *workers[self];
+            std::unique_lock<std::mutex> lock(w.mtx);
+            w.local.push_back(std::move(task));
+        } else {
+            std::unique_lock<std::mutex> lock(mtx);
+            tasks.push(priority, std::move(task));
+        }
+        // pairs with Prepare in threadfunc, either we see the parking worker or it sees the task
+        events.NotifyOne();
+    }
+
+    /**
+     * Account for one more queued task unless the pool is at capacity, and report crossing the watermark
+     * 
+     * @return false if the pool is full
+     */
+    bool reserve() {
+        size_t crossed = 0;
+        if (!claim(crossed)) return false;
+        if (crossed) saturate(crossed);
+        return true;
+    }
+
+    /**
+     * The accounting half of reserve, safe to call under mtx
+     * 
+     * @param crossed set to the queued count if this task took the queue past the watermark
+     * @return false if the pool is full
+     */
+    bool claim(size_t& crossed) {
+        if (bounds.capacity == 0) {
+            pending.fetch_add(1);
+            return true;
+        }
+        size_t queued = pending.load();
+        do {
+            if (queued >= bounds.capacity) return false;
+        } while (!pending.compare_exchange_weak(queued, queued + 1));
+        size_t mark = static_cast<size_t>(bounds.watermark * static_cast<double>(bounds.capacity));
+        if (bounds.saturated && queued < mark && queued + 1 >= mark) crossed = queued + 1;
+        return true;
+    }
+
+    // run the backpressure hook, never under a lock of the pool
+    void saturate(size_t queued) {
+        trace::Emit<trace::Level::Info>("fixed thread pool queue is saturated", queued);
+        bounds.saturated(queued, bounds.capacity);
+    }
+
+    // n queued tasks were taken or dropped, let blocked submitters retry
+    void release(size_t n) {
+        pending.fetch_sub(n);
+        // pairs with the blocked increment in overflow, either we see the submitter or it sees the room
+        if (blocked.load() > 0) {
+            std::unique_lock<std::mutex> lock(mtx);
+            space.notify_all();
+        }
+    }
+
+    /**
+     * Apply the overflow policy to a task that found the pool full
+     */
+    void overflow(threadpool::Priority priority, threadpool::Entry task) {
+        threadpool::Overflow policy = bounds.overflow;
+        if (policy == threadpool::Overflow::Block && owner == this) policy = threadpool::Overflow::CallerRuns;
+        switch (policy) {
+            case threadpool::Overflow::Block: {
+                bool reserved = false;
+                size_t crossed = 0;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    blocked.fetch_add(1);
+                    space.wait(lock, [this, &reserved, &crossed] () -> bool {
+                        return !accepting || (reserved = claim(crossed));
+                    });
+                    blocked.fetch_sub(1);
+                }
+                if (crossed) saturate(crossed);
+                if (reserved) {
+                    submit(priority, std::move(task));
+                } else {
+                    task.fn.Fail(std::make_exception_ptr(
+                        threadpool::Rejected("fixed thread pool is no longer running")));
+                }
+                return;
+            }
+            case threadpool::Overflow::CallerRuns:
+                trace::Emit<trace::Level::Debug>("fixed thread pool is full, running task on the caller");
+                invoke(task.fn);
+                return;
+            case threadpool::Overflow::DropOldest: {
+                threadpool::Entry victim;
+                bool dropped = false;
+                {
+                    // the victim's slot passes to the new task, pending is unchanged
+                    std::unique_lock<std::mutex> lock(mtx);
+                    if (tasks.drop(victim)) {
+                        tasks.push(priority, std::move(task));
+                        dropped = true;
+                    }
+                }
+                if (!dropped) break; // everything queued sits in worker deques, reject the new task instead
+                trace::Emit<trace::Level::Warn>("fixed thread pool is full, dropped the oldest task");
+                victim.fn.Fail(
+                    std::make_exception_ptr(threadpool::Rejected("task dropped: fixed thread pool is full")));
+                return;
+            }
+            default:
+                break;
+        }
+        trace::Emit<trace::Level::Warn>("failed to execute: fixed thread pool is full");
+        task.fn.Fail(std::make_exception_ptr(threadpool::Rejected("fixed thread pool is full")));
+    }
+
+    /**
+     * Find a task: in shared mode the global queue only, in stealing mode own deque (newest first), then the global 
+     * queue, then the other workers' deques (oldest first), workers on the same numa node before remote ones. The 
+     * global queue goes ahead of the own deque while it holds urgent tasks and once every threadpool::fairness 
+     * local pops, so a worker feeding itself cannot starve it.
+     */
+    bool take(size_t id, threadpool::Entry& task) {
+        if (mode != threadpool::Mode::Stealing) {
+            std::unique_lock<std::mutex> lock(mtx);
+            return tasks.pop(task);
+        }
+        threadpool::Worker& w = *workers[id];
+        if (tasks.urgent() || w.pops >= threadpool::fairness) {
+            w.pops = 0;
+            std::unique_lock<std::mutex> lock(mtx);
+            if (tasks.pop(task)) return true;
+        }
+        {
+            std::unique_lock<std::mutex> lock(w.mtx);
+            if (!w.local.empty()) {
+                task = std::move(w.local.back());
+                w.local.pop_back();
+                ++w.pops;
+                return true;
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (tasks.pop(task)) return true;
+        }
+        for (size_t v : victims[id]) {
+            threadpool::Worker& victim = *workers[v];
+            std::unique_lock<std::mutex> lock(victim.mtx, std::try_to_lock); // skip a busy victim, try the next
+            if (lock.owns_lock() && !victim.local.empty()) {
+                task = std::move(victim.local.front());
+                victim.local.pop_front();
+                stats::Counters::add(counters[id]->steals, 1);
+                return true;
+            }
+        }
+        return false;
+    }
 };
 
 
-// /**
-//  * A cached thread pool implementation
-//  * 
-//  * @tparam tnum the maximum number of cached threads at a specific time point
-//  */
-// template<size_t max>
-// class CachedThreadPool {
+/**
+ * A cached (elastic) thread pool implementation
+ * 
+ * Workers are spawned on demand when a task arrives and no worker is idle, up to max. A worker that stays idle 
+ * longer than timeout retires, unless that would leave fewer than min workers alive. A retiring worker detaches its 
+ * own thread object, so its stack is given back as soon as it exits and no reaper thread is needed; the destructor 
+ * joins the workers still registered and waits on the alive count for the ones that are on their way out.
+ * 
+ * Usage example:
+ *      CachedThreadPool executor = CachedThreadPool(2, 64, std::chrono::seconds(30));
+ */
+class CachedThreadPool {
 
-// private:
+private:
 
-//     std::thread repear;
-//     std::vector<int> idle;
-//     std::mutex reapmtx;
-//     std::condition_variable reap;
+    const size_t min;
+    const size_t max;
+    const std::chrono::milliseconds timeout;
 
-//     int tidCounter;
-//     std::unordered_map<int, std::unique_ptr<std::thread>> threads;
-//     std::atomic<size_t> tnum;
-//     std::chrono::seconds timeout;
-    
-//     std::queue<std::function<void()>> tasks;
-
-//     std::mutex mtx;
-//     std::condition_variable cond;
-
-//     std::atomic<bool> running;
-
-// public:
-
-//     CachedThreadPool(std::chrono::seconds t) : tidCounter(1), timeout(t), running(true) {
-//         // create a long live repear thread
-//         repear = std::thread([this] () -> void {
-//             while (true) {
-//                 std::unique_lock<std::mutex> lock(reapmtx);
-//                 reap.wait(lock, [this] () -> bool { return !idle.empty(); });
-//                 int id = idle.back();
-//                 idle.pop_back();
-//                 if (threads[id]->joinable()) {
-//                     threads[id]->join();
-//                     threads.erase(id);
-//                 }
-//             }
-//         });
-//     }
-
-//     ~CachedThreadPool() {}
-
-//     template<typename Func, typename... Args>
-//     auto Exec(Func&& fun, Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
-//         if (!running) {
-//             std::cerr << "Failed to execute: cached thread pool is no longer running." << std::endl;
-//         }
-//         using return_type = std::invoke_result_t<Func, Args...>;
-//         auto task = std::make_shared<std::packaged_task<return_type()>>(
-//             std::bind(std::forward<Func>(fun), std::forward<Args>(args)...)
-//         );
-//         {
-//             std::unique_lock<std::mutex> lock(mtx);
-//             tasks.emplace([task] () -> bool { (*task)(); });
-//             cond.notify_one();
-//         }
-//         return task->get_future();
-//     }
-
-// private: // helpers
-
-//     void threadfunc(int id) {
-//         while (true) {
-//             std::function<void()> task;
-//             {
-//                 std::unique_lock<std::mutex> lock(mtx);
-//                 if (!cond.wait_for(lock, timeout, [this] () -> bool { return !tasks.empty(); })) {
-//                     // the thread has been blocked over timeout seconds because of empty task queue, break the loop
-//                     break;
-//                 }
-//                 task = tasks.front();
-//                 tasks.pop();
-//             }
-//             std::cout << "CachedThread - " << id << " is executing task." << std::endl;
-//             task();
-//             std::cout << "CachedThread - " << id << " finished the task." << std::endl;
-//         }
-//     }
-
-// };
\ No newline at end of file
+    int tidCounter;
+    std::unordered_map<int, std::unique_ptr<std::thread>> threads; // guarded by mtx
+
+    size_t alive; // guarded by mtx
+    size_t idle; // workers waiting for a task, guarded by mtx
+
+    threadpool::Ring<threadpool::Runnable> tasks;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::condition_variable gone; // signalled when the last worker leaves
+
+    std::atomic<bool> running;
+
+public:
+
+    /**
+     * @param mn the number of warm workers that never retire, started eagerly
+     * @param mx the maximum number of workers alive at the same time
+     * @param t how long a worker may stay idle before it retires
+     */
+    template<typename Rep, typename Period>
+    CachedThreadPool(size_t mn, size_t mx, std::chrono::duration<Rep, Period> t) 
+    : min(mn), max(mx < 1 ? 1 : mx), timeout(std::chrono::duration_cast<std::chrono::milliseconds>(t)), 
+      tidCounter(0), alive(0), idle(0), running(true) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (alive < min && alive < max) {
+            spawn();
+        }
+    }
+
+    /**
+     * Stop every worker after its current task, tasks still queued are completed with threadpool::Cancelled
+     */
+    ~CachedThreadPool() {
+        std::unordered_map<int, std::unique_ptr<std::thread>> remaining;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            running = false;
+            cond.notify_all();
+            remaining.swap(threads);
+        }
+        for (auto& [id, t]: remaining) {
+            if (t->joinable()) t->join();
+        }
+        threadpool::Ring<threadpool::Runnable> dropped;
+        {
+            // workers that detached themselves before we took the map still touch the pool until they leave
+            std::unique_lock<std::mutex> lock(mtx);
+            gone.wait(lock, [this] () -> bool { return alive == 0; });
+            std::swap(dropped, tasks);
+        }
+        if (!dropped.empty()) trace::Emit<trace::Level::Info>("cancelled queued tasks", dropped.size());
+        while (!dropped.empty()) {
+            dropped.front().Fail(std::make_exception_ptr(threadpool::Cancelled()));
+            dropped.pop_front();
+        }
+    }
+
+    /**
+     * Execute the given command, spawning a new worker if none is idle and fewer than max are alive.
+     * 
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto Exec(Func&& fun, Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        std::future<return_type> res;
+        threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
+        if (!running) {
+            task.Fail(std::make_exception_ptr(threadpool::Rejected("cached thread pool is no longer running")));
+            return res;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            tasks.push_back(std::move(task));
+            // every idle worker already has a queued task to pick up, grow if we still may
+            if (idle < tasks.size() && alive < max) {
+                spawn();
+            } else {
+                cond.notify_one();
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Number of workers currently alive
+     */
+    size_t Size() {
+        std::unique_lock<std::mutex> lock(mtx);
+        return alive;
+    }
+
+private: // helpers
+
+    // caller holds mtx
+    void spawn() {
+        int id = tidCounter++;
+        ++alive;
+        threads.emplace(id, std::make_unique<std::thread>(&CachedThreadPool::threadfunc, this, id));
+    }
+
+    void threadfunc(int id) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            ++idle;
+            bool ready = cond.wait_for(lock, timeout, [this] () -> bool { return !running || !tasks.empty(); });
+            --idle;
+            if (!running) break;
+            if (!ready) {
+                // idle for longer than timeout, retire unless we are part of the warm minimum
+                if (alive > min) break;
+                continue;
+            }
+            threadpool::Runnable task = std::move(tasks.front());
+            tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+        // the destructor may already have taken our thread object to join it, otherwise nobody will: detach
+        auto self = threads.find(id);
+        if (self != threads.end()) {
+            self->second->detach();
+            threads.erase(self);
+        }
+        // last access to the pool, the destructor may go ahead once we release mtx
+        if (--alive == 0) gone.notify_all();
+    }
+
+};
@@ -0,0 +1,190 @@
+/**
+ * Asynchronous trace sink for the thread pools
+ *
+ * Emitting a record never blocks and never takes a lock: the record is pushed into a lock-free BlockingQueue and a
+ * background thread hands it to the sink, so workers never serialize on an iostream lock or pay for a flush. When
+ * the queue is full the record is dropped and counted instead. The drainer polls the queue and sleeps on a timer
+ * while it is empty rather than parking on the queue, so a push never has a parked consumer to wake.
+ *
+ * Levels below THREADPOOL_TRACE_LEVEL compile out entirely, the default keeps Info and above, so the per-task Debug
+ * records cost nothing unless the pool is built with -DTHREADPOOL_TRACE_LEVEL=0. Compiled-in levels can still be
+ * filtered at runtime with SetLevel.
+ *
+ * Usage example:
+ *      trace::Tracer::Instance().SetLevel(trace::Level::Info);
+ *      trace::Tracer::Instance().SetSink([] (const trace::Record& r) -> void { ... });
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+#include <chrono>
+#include <iostream>
+
+#include "blockingds.hpp"
+
+
+#ifndef THREADPOOL_TRACE_LEVEL
+#define THREADPOOL_TRACE_LEVEL 1
+#endif
+
+
+namespace trace
+{
+
+    enum class Level : int {
+        Debug = 0,
+        Info = 1,
+        Warn = 2,
+        Error = 3,
+        Off = 4
+    };
+
+    inline constexpr Level compiled = static_cast<Level>(THREADPOOL_TRACE_LEVEL);
+
+    /**
+     * One trace event, the message must be a string with static storage duration (a literal), it is not copied
+     */
+    struct Record {
+        Level level{Level::Off};
+        const char* message{""};
+        int64_t value{0};
+        int worker{-1}; // the pool worker that emitted the record, -1 for other threads
+        std::chrono::steady_clock::time_point time;
+    };
+
+    inline const char* Name(Level level) {
+        switch (level) {
+            case Level::Debug: return "DEBUG";
+            case Level::Info: return "INFO";
+            case Level::Warn: return "WARN";
+            case Level::Error: return "ERROR";
+            default: return "OFF";
+        }
+    }
+
+    /**
+     * Process-wide trace queue and its drainer thread, started lazily by the first record that passes the runtime
+     * level filter
+     */
+    class Tracer {
+
+    private:
+
+        static constexpr size_t capacity = 4096;
+
+        // how long the drainer sleeps on an empty queue, doubling from min to max while it stays empty
+        static constexpr std::chrono::milliseconds minPoll{1};
+        static constexpr std::chrono::milliseconds maxPoll{50};
+
+        BlockingQueue<Record> queue;
+        std::atomic<Level> level;
+        std::atomic<uint64_t> dropped;
+
+        std::mutex mtx; // guards sink
+        std::function<void(const Record&)> sink;
+
+        std::once_flag started;
+        std::unique_ptr<std::thread> drainer;
+        std::atomic<bool> running;
+
+        Tracer() : queue(capacity), level(Level::Warn), dropped(0), running(true) {
+            sink = [] (const Record& r) -> void {
+                std::clog << "[" << Name(r.level) << "] " << r.message;
+                if (r.worker >= 0) std::clog << " (worker " << r.worker << ")";
+                std::clog << " " << r.value << '\n';
+            };
+        }
+
+    public:
+
+        static Tracer& Instance() {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        ~Tracer() {
+            running = false;
+            if (drainer && drainer->joinable()) drainer->join();
+        }
+
+        /**
+         * Only records at or above this level are queued, records below THREADPOOL_TRACE_LEVEL never reach here
+         */
+        void SetLevel(Level l) {
+            level.store(l, std::memory_order_relaxed);
+        }
+
+        bool Enabled(Level l) const {
+            return l >= level.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Replace the sink, it is only ever called from the drainer thread
+         */
+        void SetSink(std::function<void(const Record&)> s) {
+            std::unique_lock<std::mutex> lock(mtx);
+            sink = std::move(s);
+        }
+
+        /**
+         * Number of records dropped because the queue was full
+         */
+        uint64_t Dropped() const {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        void Push(const Record& r) {
+            std::call_once(started, [this] () -> void {
+                drainer = std::make_unique<std::thread>(&Tracer::drainfunc, this);
+            });
+            if (!queue.TryPush(r)) dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+
+        void drainfunc() {
+            Record r;
+            std::chrono::milliseconds poll = minPoll;
+            while (running || !queue.Empty()) {
+                if (!queue.TryPop(r)) {
+                    std::this_thread::sleep_for(poll);
+                    poll = std::min(poll * 2, maxPoll);
+                    continue;
+                }
+                poll = minPoll;
+                std::unique_lock<std::mutex> lock(mtx);
+                if (sink) sink(r);
+            }
+        }
+    };
+
+    /**
+     * Emit a record, compiles to nothing when L is below THREADPOOL_TRACE_LEVEL
+     *
+     * @param message a string literal
+     * @param value a number attached to the record
+     * @param worker the emitting pool worker, -1 otherwise
+     */
+    template<Level L>
+    inline void Emit([[maybe_unused]] const char* message, [[maybe_unused]] int64_t value = 0, 
+                     [[maybe_unused]] int worker = -1) {
+        if constexpr (L >= compiled && L != Level::Off) {
+            Tracer& tracer = Tracer::Instance();
+            if (!tracer.Enabled(L)) return;
+            tracer.Push(Record{L, message, value, worker, std::chrono::steady_clock::now()});
+        }
+    }
+
+} // namespace trace
@@ -1,16 +1,200 @@
 /**
- * 
+ * Keyed serial executor (strands) over a FixedThreadPool
+ *
+ * Tasks submitted under the same key run one at a time in submission order, tasks under different keys run in
+ * parallel on the pool's workers. A key's queue (its strand) is created by the first task for that key and dropped
+ * as soon as it runs empty, so only keys with work in flight cost memory. No worker ever blocks on another: a strand
+ * is a single runnable on the pool that drains a few tasks and, if more are queued, posts itself again.
+ *
+ * Strands are posted as tenants of the pool's fair queue, one tenant per key, so a backlogged key gets its turns
+ * alongside every other key and never holds a worker for more than one burst, in stealing mode too: a tenant's
+ * task always goes through the shared queue, never onto the posting worker's own deque.
  */
 
 
 #pragma once
 
 
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <functional>
+#include <future>
+#include <exception>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include <mutex>
+
+#include "../concurrent/threadpool.hpp"
+
+
+namespace dispatcher
+{
+
+    // tasks a strand runs per turn on a worker before it lets other work in
+    inline constexpr size_t burst = 16;
+
+    inline constexpr size_t shards = 64;
+
+    struct Strand {
+        threadpool::Ring<threadpool::Runnable> queue;
+    };
+
+    /**
+     * One slice of the key space, a key's strand exists in its shard's map exactly while it has queued or running
+     * tasks and is scheduled on the pool exactly once during that time
+     */
+    template<typename Key, typename Hash>
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<Key, std::shared_ptr<Strand>, Hash> strands;
+    };
+
+} // namespace dispatcher
+
+
+/**
+ * A keyed dispatcher
+ *
+ * Usage example:
+ *      Dispatcher<std::string> sessions = Dispatcher<std::string>(ptr);
+ *      sessions.Dispatch("alice", [] () -> void { ... });
+ */
+template<typename Key, typename Hash = std::hash<Key>>
 class Dispatcher {
-    
+
+    using Shard = dispatcher::Shard<Key, Hash>;
+    using Strand = dispatcher::Strand;
+
 private:
 
+    std::shared_ptr<FixedThreadPool> core;
+
+    /**
+     * shared with the strands posted on the pool, so a strand that outlives the dispatcher still finds its shard
+     */
+    std::shared_ptr<Shard[]> shards;
+
 public:
 
-};
+    explicit Dispatcher(std::shared_ptr<FixedThreadPool> ftp)
+    : core(std::move(ftp)), shards(new Shard[dispatcher::shards]) {}
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    Dispatcher(Dispatcher&&) noexcept = default;
+
+    /**
+     * Run the given command after every command dispatched earlier under the same key, and never concurrently
+     * with them.
+     *
+     * @param key the serialization key
+     * @param fun the runnable
+     * @param args the params passed to the runnable
+     */
+    template<typename Func, typename... Args>
+    auto Dispatch(const Key& key, Func&& fun, Args&&... args) -> std::future<std::invoke_result_t<Func, Args...>> {
+        using return_type = std::invoke_result_t<Func, Args...>;
+        std::future<return_type> res;
+        threadpool::Runnable task = threadpool::package(res, std::forward<Func>(fun), std::forward<Args>(args)...);
+        Post(key, std::move(task));
+        return res;
+    }
 
+    /**
+     * Queue a runnable on the strand of key without a future, an exception escaping it is traced and dropped
+     */
+    void Post(const Key& key, threadpool::Runnable task) {
+        Shard& shard = shards[Hash()(key) % dispatcher::shards];
+        std::shared_ptr<Strand> strand;
+        {
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            auto [it, fresh] = shard.strands.try_emplace(key);
+            if (!fresh) {
+                // the strand is scheduled already and will get to the task
+                it->second->queue.push_back(std::move(task));
+                return;
+            }
+            it->second = std::make_shared<Strand>();
+            it->second->queue.push_back(std::move(task));
+            strand = it->second;
+        }
+        schedule(core.get(), shards, key, std::move(strand));
+    }
+
+    /**
+     * Number of keys that currently have queued or running tasks
+     */
+    size_t Active() const {
+        size_t n = 0;
+        for (size_t i = 0; i < dispatcher::shards; ++i) {
+            std::unique_lock<std::mutex> lock(shards[i].mtx);
+            n += shards[i].strands.size();
+        }
+        return n;
+    }
+
+private: // helpers
+
+    /**
+     * The runnable a strand occupies the pool with
+     */
+    struct Turn {
+        FixedThreadPool* pool;
+        std::shared_ptr<Shard[]> shards;
+        Key key;
+        std::shared_ptr<Strand> strand;
+
+        void operator()() {
+            Shard& shard = shards[Hash()(key) % dispatcher::shards];
+            for (size_t i = 0; i < dispatcher::burst; ++i) {
+                threadpool::Runnable task;
+                {
+                    std::unique_lock<std::mutex> lock(shard.mtx);
+                    if (strand->queue.empty()) {
+                        // idle, reclaim it; the next task for this key starts a new strand
+                        shard.strands.erase(key);
+                        return;
+                    }
+                    task = std::move(strand->queue.front());
+                    strand->queue.pop_front();
+                }
+                try {
+                    task();
+                } catch (...) {
+                    // a bare runnable has nobody to report to, and the rest of the strand must still run
+                    trace::Emit<trace::Level::Error>("dispatched task threw an exception, dropped");
+                }
+            }
+            // more queued, give other work a turn and come back
+            schedule(pool, std::move(shards), std::move(key), std::move(strand));
+        }
+
+        // the pool refused the strand, nobody will run its tasks: fail them and drop the strand
+        void Fail(std::exception_ptr e) {
+            Shard& shard = shards[Hash()(key) % dispatcher::shards];
+            threadpool::Ring<threadpool::Runnable> dropped;
+            {
+                std::unique_lock<std::mutex> lock(shard.mtx);
+                std::swap(dropped, strand->queue);
+                shard.strands.erase(key);
+            }
+            while (!dropped.empty()) {
+                dropped.front().Fail(e);
+                dropped.pop_front();
+            }
+        }
+    };
+
+    static void schedule(FixedThreadPool* pool, std::shared_ptr<Shard[]> shards, Key key,
+        std::shared_ptr<Strand> strand) {
+        // the top bit keeps the key's tenant apart from tenant 0, which may be queued on a worker's own deque
+        threadpool::Tenant tenant{static_cast<uint64_t>(Hash()(key)) | (uint64_t(1) << 63)};
+        pool->Post(threadpool::Runnable(Turn{pool, std::move(shards), std::move(key), std::move(strand)}),
+            threadpool::Priority::Normal, threadpool::clock::time_point::max(), tenant);
+    }
+};
@@ -6,11 +6,9 @@
 
 int main() {
 
-    FixedThreadPool threadpool = FixedThreadPool(4);
+    std::shared_ptr<FixedThreadPool> ptr = std::make_shared<FixedThreadPool>(4);
 
-    std::shared_ptr<FixedThreadPool> ptr = std::make_shared<FixedThreadPool>(threadpool);
-
-    auto secTimeWheel = TimeWheel<int, std::chrono::seconds>(60, 1, ptr);
+    auto secTimeWheel = TimeWheel<int, std::ratio<1>>(60, 1, ptr);
 
     return 0;
 }
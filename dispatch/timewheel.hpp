@@ -1,5 +1,15 @@
 /**
  * scheduled tasks are executed at the end of a tick, rather than executed precisely according to their presetted delay
+ *
+ * The wheel is hierarchical (Varghese & Lauck): level 0 has one slot per tick, every slot of level k spans a whole
+ * rotation of level k - 1. A task is filed at the lowest level whose range covers its delay, and whenever a lower
+ * level completes a rotation the next slot of the level above is cascaded, its tasks re-filed closer to the bottom.
+ * A level 0 slot therefore only ever holds tasks due in that very tick, and a tick touches nothing that is not due,
+ * apart from the cascades, which move every task at most once per level. Delays beyond the top level's range wait
+ * in the top level and are re-filed every time their slot comes round.
+ *
+ * Periodic timers keep their node for their whole life and are re-filed in place after every period, a fixed-rate
+ * timer at absolute multiples of its period so it does not drift however late its callbacks run.
  */
 
 
@@ -7,29 +17,86 @@
 
 
 #include <cstddef>
+#include <cstdint>
 
 #include <chrono>
 
+#include <algorithm>
+#include <deque>
 #include <vector>
 #include <functional>
 
 #include <atomic>
 #include <thread>
 #include <memory>
+#include <exception>
 
 #include <mutex>
 
+#include <coroutine>
+
 #include "../concurrent/threadpool.hpp"
 
 
 namespace timewheel
 {
 
-    struct Task {
-        int id{0};
-        size_t life{0};
+    /**
+     * How a periodic timer is re-armed
+     *
+     * FixedRate: due at start + k * period; a period that comes round while the previous callback has not finished 
+     *      (the pool is saturated) is skipped and counted as missed instead of piling up runs
+     * FixedDelay: due one period after the previous callback has finished, never misses
+     */
+    enum class Repeat {
+        FixedRate,
+        FixedDelay
+    };
+
+    /**
+     * A timer, intrusively linked into its slot's list so it can be unlinked in O(1) without a search
+     *
+     * Nodes live in a slab and are recycled; the handle given out for a timer is its slab index together with the 
+     * generation of the node, which is bumped every time the node is freed, so a handle outliving its timer is 
+     * recognised instead of touching the node's next occupant.
+     */
+    struct Node {
+        Node* next{nullptr};
+        Node** pprev{nullptr}; // the link pointing at this node, nullptr while the node is not filed
+        uint64_t expiry{0}; // absolute tick the task is due in
+        uint32_t index{0};
+        uint32_t generation{0};
         std::shared_ptr<std::function<void()>> task{nullptr};
+
+        // periodic timers only
+        uint64_t period{0}; // in ticks, 0 for a one-shot timer
+        Repeat repeat{Repeat::FixedRate};
+        bool live{false}; // not cancelled, the node is freed by the callback still in flight otherwise
+        bool inflight{false}; // a callback has been posted and has not finished
+        uint64_t missed{0};
+
+        bool filed() const {
+            return pprev != nullptr;
+        }
+
+        void link(Node*& head) {
+            next = head;
+            if (next) next->pprev = &next;
+            head = this;
+            pprev = &head;
+        }
+
+        void unlink() {
+            *pprev = next;
+            if (next) next->pprev = pprev;
+            next = nullptr;
+            pprev = nullptr;
+        }
     };
+
+    inline size_t handle(const Node& node) {
+        return (static_cast<size_t>(node.generation) << 32) | node.index;
+    }
     
 } // namespace timewheel
 
@@ -38,7 +105,11 @@ namespace timewheel
  * A time wheel dispatcher implementation
  * 
  * Usage example:
- *      TimeWheel<int, std::ratio<1>> tw = TimeWheel(60, 1, ptr);
+ *      // seconds, minutes, hours and days
+ *      TimeWheel<int, std::ratio<1>> tw = TimeWheel<int, std::ratio<1>>(60, 1, ptr, 4);
+ *      size_t id = tw.Appoint(30, f);
+ *      tw.Cancel(id);
+ *      size_t heartbeat = tw.AppointEvery(5, f, timewheel::Repeat::FixedRate);
  */
 template<typename Rep, typename Period>
 class TimeWheel {
@@ -46,16 +117,20 @@ class TimeWheel {
     using clock = std::chrono::high_resolution_clock;
     using duration = std::chrono::duration<Rep, Period>;
 
-    using Task = timewheel::Task;
+    using Node = timewheel::Node;
 
 private:
 
-    const size_t size;
+    const size_t size; // slots per level
     const Rep tick; // the duration of a tick
+    const size_t levels;
 
-    std::vector<std::vector<Task>> slots;
-    std::atomic<size_t> nextid;
-    std::atomic<size_t> idx;
+    std::vector<uint64_t> spans; // ticks covered by one slot of each level
+    std::vector<std::vector<Node*>> slots; // [level][slot] list heads, guarded by mtx
+    uint64_t current; // the tick being processed next, guarded by mtx
+
+    std::deque<Node> nodes; // slab, a deque never moves its elements, guarded by mtx
+    std::vector<uint32_t> spare; // indices of free nodes, guarded by mtx
 
     std::unique_ptr<std::thread> ticker; // simulate tick
 
@@ -63,12 +138,27 @@ private:
 
     std::shared_ptr<FixedThreadPool> core;
 
+    std::atomic<size_t> callbacks; // periodic callbacks posted and not finished, they refer to the wheel
+
     std::atomic<bool> running;
 
 public:
 
-    TimeWheel(size_t s, Rep t, std::shared_ptr<FixedThreadPool> ftp)
-    : size(s), tick(t), core(std::move(ftp)), slots(s), nextid(0), idx(0), running(true) {
+    /**
+     * @param s slots per level
+     * @param t the duration of a tick
+     * @param ftp the pool due tasks are posted to
+     * @param l number of levels, the wheel covers s^l ticks without re-filing
+     */
+    TimeWheel(size_t s, Rep t, std::shared_ptr<FixedThreadPool> ftp, size_t l = 4)
+    : size(s), tick(t), levels(l == 0 ? 1 : l), slots(levels, std::vector<Node*>(s, nullptr)), current(0), 
+      core(std::move(ftp)), callbacks(0), running(true) {
+        uint64_t span = 1;
+        for (size_t i = 0; i < levels; ++i) {
+            spans.push_back(span);
+            // saturate instead of overflowing, such a level is never reached
+            span = span > UINT64_MAX / size ? UINT64_MAX : span * size;
+        }
         ticker = std::make_unique<std::thread>(&TimeWheel::tickerfunc, this);
     }
 
@@ -77,61 +167,277 @@ public:
             std::unique_lock<std::mutex> lock(mtx);
             running = false;
         }
+        if (ticker->joinable()) ticker->join();
+        // periodic callbacks still queued or running on the pool come back to the wheel when they finish
+        for (size_t n = callbacks.load(); n != 0; n = callbacks.load()) callbacks.wait(n);
     }
 
+    /**
+     * Run f on the pool once delay has passed
+     * 
+     * @return the timer's handle for Cancel and Reschedule
+     */
     size_t Appoint(Rep delay, std::shared_ptr<std::function<void()>> f) {
-        size_t ticks = delay / tick;
-        size_t life = ticks / size;
-        size_t slot = (idx + ticks % size) % size;
-        // generate task
-        Task task = Task();
-        task.id = nextid.fetch_add(1);
-        task.life = life;
-        task.task = std::move(f);
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            slots[i].push_back(task);
-        }
-        return task.id;
+        std::unique_lock<std::mutex> lock(mtx);
+        Node* node = acquire();
+        node->task = std::move(f);
+        node->expiry = current + ticks(delay);
+        file(node);
+        return timewheel::handle(*node);
+    }
+
+    /**
+     * Run f on the pool every period until the timer is cancelled, the first run is one period from now
+     * 
+     * @param period the interval, at least one tick
+     * @param f the callback, never run concurrently with itself
+     * @param repeat fixed rate (drift-free, skips periods while the previous run is still going) or fixed delay
+     * @return the timer's handle for Cancel, Reschedule and Missed
+     */
+    size_t AppointEvery(Rep period, std::shared_ptr<std::function<void()>> f, 
+        timewheel::Repeat repeat = timewheel::Repeat::FixedRate) {
+        std::unique_lock<std::mutex> lock(mtx);
+        Node* node = acquire();
+        node->task = std::move(f);
+        node->period = std::max<uint64_t>(1, ticks(period));
+        node->repeat = repeat;
+        node->live = true;
+        node->expiry = current + node->period;
+        file(node);
+        return timewheel::handle(*node);
+    }
+
+    /**
+     * Cancel a timer that has not fired yet, or stop a periodic one, O(1); a periodic callback that is running 
+     * already finishes
+     * 
+     * @return false if the timer has already fired or been cancelled
+     */
+    bool Cancel(size_t id) {
+        std::unique_lock<std::mutex> lock(mtx);
+        Node* node = find(id);
+        if (!node) return false;
+        if (node->filed()) node->unlink();
+        node->live = false;
+        if (!node->inflight) release(node);
+        return true;
+    }
+
+    /**
+     * Move a timer that is waiting to fire to fire delay from now, O(1); the handle stays valid and a periodic timer 
+     * continues with its period from there
+     * 
+     * @return false if the timer has already fired or been cancelled, or is a fixed-delay timer whose callback is 
+     *      running (it is not waiting for a time yet)
+     */
+    bool Reschedule(size_t id, Rep delay) {
+        std::unique_lock<std::mutex> lock(mtx);
+        Node* node = find(id);
+        if (!node || !node->filed()) return false;
+        node->unlink();
+        node->expiry = current + ticks(delay);
+        file(node);
+        return true;
+    }
+
+    /**
+     * Number of periods a fixed-rate timer has skipped because its previous callback was still queued or running
+     */
+    uint64_t Missed(size_t id) {
+        std::unique_lock<std::mutex> lock(mtx);
+        Node* node = find(id);
+        return node ? node->missed : 0;
+    }
+
+    /**
+     * Awaitable that suspends the awaiting coroutine for delay, it is resumed on a worker of the wheel's pool
+     * 
+     * Usage example:
+     *      co_await wheel.Sleep(5);
+     */
+    auto Sleep(Rep delay) {
+        struct Awaiter {
+            TimeWheel* wheel;
+            Rep delay;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                wheel->Appoint(delay, std::make_shared<std::function<void()>>([h] () -> void { h.resume(); }));
+            }
+
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{this, delay};
     }
 
 private:
 
+    uint64_t ticks(Rep delay) const {
+        return delay > 0 ? static_cast<uint64_t>(delay / tick) : 0;
+    }
+
+    // a free node from the slab, guarded by mtx
+    Node* acquire() {
+        if (spare.empty()) {
+            nodes.emplace_back();
+            nodes.back().index = static_cast<uint32_t>(nodes.size() - 1);
+            return &nodes.back();
+        }
+        Node* node = &nodes[spare.back()];
+        spare.pop_back();
+        return node;
+    }
+
+    // return an unlinked node to the slab, invalidating its handle, guarded by mtx
+    void release(Node* node) {
+        node->task = nullptr;
+        node->period = 0;
+        node->live = false;
+        node->inflight = false;
+        node->missed = 0;
+        ++node->generation;
+        spare.push_back(node->index);
+    }
+
+    // the node of a pending one-shot or live periodic timer, nullptr if the timer is gone, guarded by mtx
+    Node* find(size_t id) {
+        size_t index = id & 0xffffffffu;
+        if (index >= nodes.size()) return nullptr;
+        Node* node = &nodes[index];
+        if (node->generation != static_cast<uint32_t>(id >> 32)) return nullptr;
+        if (node->period == 0 ? !node->filed() : !node->live) return nullptr;
+        return node;
+    }
+
+    /**
+     * A due periodic timer: post its callback unless the previous one is still in flight, and re-arm a fixed-rate 
+     * timer for its next period right away, guarded by mtx
+     */
+    void fire(Node* node, std::vector<threadpool::Runnable>& todos) {
+        if (node->inflight) {
+            node->missed++;
+            trace::Emit<trace::Level::Debug>("periodic timer missed a period", static_cast<int>(node->index));
+        } else {
+            node->inflight = true;
+            callbacks.fetch_add(1);
+            todos.emplace_back(Callback{this, node});
+        }
+        if (node->repeat == timewheel::Repeat::FixedRate) {
+            node->expiry += node->period;
+            file(node);
+        }
+    }
+
+    /**
+     * The runnable of a periodic timer, it re-arms a fixed-delay timer and frees a cancelled one when done
+     */
+    struct Callback {
+        TimeWheel* wheel;
+        Node* node;
+
+        void operator()() {
+            try {
+                (*node->task)(); // the node keeps the callback while inflight is set
+            } catch (...) {
+                // the timer keeps its schedule, and done must run or the node stays in flight for good
+                trace::Emit<trace::Level::Error>("periodic timer callback threw an exception", 
+                    static_cast<int>(node->index));
+            }
+            done();
+        }
+
+        void Fail(std::exception_ptr) {
+            done();
+        }
+
+        void done() {
+            {
+                std::unique_lock<std::mutex> lock(wheel->mtx);
+                node->inflight = false;
+                if (!node->live) {
+                    wheel->release(node);
+                } else if (node->repeat == timewheel::Repeat::FixedDelay) {
+                    node->expiry = wheel->current + node->period;
+                    wheel->file(node);
+                }
+            }
+            // last access to the wheel, the destructor may go ahead after this
+            if (wheel->callbacks.fetch_sub(1) == 1) wheel->callbacks.notify_all();
+        }
+    };
+
+    /**
+     * Link a node into the lowest level whose range covers its delay, guarded by mtx
+     */
+    void file(Node* node) {
+        uint64_t delta = node->expiry > current ? node->expiry - current : 0;
+        size_t level = 0;
+        while (level + 1 < levels && delta >= spans[level + 1]) ++level;
+        if (delta == 0) node->expiry = current; // overdue, run in this tick
+        node->link(slots[level][static_cast<size_t>((node->expiry / spans[level]) % size)]);
+    }
+
+    /**
+     * Re-file the slot of every level that starts a new span at this tick, top level first so that tasks cascaded 
+     * from above are cascaded further in the same tick, guarded by mtx
+     */
+    void cascade() {
+        size_t top = 0;
+        while (top + 1 < levels && current % spans[top + 1] == 0) ++top;
+        for (size_t level = top; level > 0; --level) {
+            // detach the whole list first, a task beyond the top level's range may be filed into this slot again
+            Node*& head = slots[level][static_cast<size_t>((current / spans[level]) % size)];
+            Node* node = head;
+            head = nullptr;
+            while (node) {
+                Node* next = node->next;
+                node->next = nullptr;
+                node->pprev = nullptr;
+                file(node);
+                node = next;
+            }
+        }
+    }
+
     void tickerfunc() {
         /**
          * exec tasks within a tick interval at the end of the tick, because need to wait until all tasks are properly
          * pushed into the task queue of that tick
          */
         clock::time_point tp = clock::now();
-        std::vector<std::function<void()>> todos;
-        // inif loop
-        while (true) {
+        std::vector<threadpool::Runnable> todos;
+        // loop until the wheel is destroyed
+        while (running) {
             // tick
             tp += duration(tick);
             std::this_thread::sleep_until(tp);
             // reset
-            todos = {};
-            // extract tasks
+            todos.clear();
+            // extract tasks, every task in the level 0 slot of this tick is due
             {
                 std::unique_lock<std::mutex> lock(mtx);
-                std::vector<Task>& bucket = slots[idx];
-                auto ptr = bucket.begin();
-                while (ptr != bucket.end()) {
-                    if (ptr->life == 0) {
-                        todo.push_back(ptr->task);
-                        ptr = bucket.erase(ptr);
-                    } else {
-                        ptr->life--;
-                        ++ptr;
+                cascade();
+                Node*& head = slots[0][static_cast<size_t>(current % size)];
+                while (head) {
+                    Node* node = head;
+                    node->unlink();
+                    if (node->period != 0) {
+                        fire(node, todos);
+                        continue;
                     }
+                    todos.emplace_back([task = std::move(node->task)] () -> void { (*task)(); });
+                    release(node);
                 }
+                // proceed to next tick
+                ++current;
             }
             // execute
-            for (std::function<void()>& task : todos) {
-                core->Exec(task);
+            for (auto& task : todos) {
+                core->Post(std::move(task));
             }
-            // proceed to next slot, atomic
-            idx = (idx + 1) % size;
         }
     }
 